@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#define CACHE_LINE 64
+
+// std::allocator that hands out storage aligned to `Align` bytes, so arrays
+// split between threads start on a cache line boundary
+template <typename T, size_t Align = CACHE_LINE>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator(){
+
+    }
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&){
+
+    }
+
+    T* allocate(size_t n){
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T* p, size_t){
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,190 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+void CubeBVH::fit_node(Node &n) const {
+    if(n.left != 0){
+        n.min = glm::min(nodes[n.left].min, nodes[n.right].min);
+        n.max = glm::max(nodes[n.left].max, nodes[n.right].max);
+        return;
+    }
+    n.min = glm::vec3(1e30f);
+    n.max = glm::vec3(-1e30f);
+    for(uint32_t k = n.first; k < n.first + n.count; k++){
+        glm::vec3 c(spheres[k]);
+        glm::vec3 r(spheres[k].w);
+        n.min = glm::min(n.min, c - r);
+        n.max = glm::max(n.max, c + r);
+    }
+}
+
+void CubeBVH::build(const SceneSoA &scene, size_t b, size_t e){
+    begin = b;
+    end = e;
+    spread = scene.cached_spread;
+    nodes.clear();
+    levels.clear();
+    size_t count = e > b ? e - b : 0;
+
+    // the split moves whole items rather than indices, so the median
+    // selection streams through memory instead of chasing indices
+    std::vector<Item> items;
+    items.reserve(count);
+    for(size_t i = b; i < e; i++){
+        glm::vec4 sphere(scene.px[i], scene.py[i], scene.pz[i],
+                         CUBE_BOUND_RADIUS * std::max(scene.sx[i], std::max(scene.sy[i], scene.sz[i])));
+        // degenerate cubes (normalized zero vectors) can never be visible,
+        // and NaNs would break the median selection
+        if(std::isfinite(sphere.x + sphere.y + sphere.z + sphere.w)){
+            items.push_back({sphere, (uint32_t)i});
+        }
+    }
+    count = items.size();
+    if(count > 0){
+        nodes.reserve(2 * count / BVH_LEAF_SIZE + 1);
+        build_node(items, 0, (uint32_t)count, 0);
+    }
+
+    order.resize(count);
+    spheres.resize(count);
+    for(size_t k = 0; k < count; k++){
+        order[k] = items[k].id;
+        spheres[k] = items[k].sphere;
+    }
+
+    // boxes bottom up, same as a refit
+    for(size_t d = levels.size(); d-- > 0;){
+        for(uint32_t id : levels[d]){
+            fit_node(nodes[id]);
+        }
+    }
+}
+
+uint32_t CubeBVH::build_node(std::vector<Item> &items, uint32_t first, uint32_t count, size_t depth){
+    uint32_t id = (uint32_t)nodes.size();
+    nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), first, count, 0, 0});
+    if(levels.size() <= depth){
+        levels.resize(depth + 1);
+    }
+    levels[depth].push_back(id);
+
+    if(count <= BVH_LEAF_SIZE){
+        return id;
+    }
+
+    // median split of the centres along the longest axis of their bounds;
+    // spread scales every centre the same way, so it does not change the split
+    glm::vec3 cmin(1e30f), cmax(-1e30f);
+    for(uint32_t k = first; k < first + count; k++){
+        glm::vec3 c(items[k].sphere);
+        cmin = glm::min(cmin, c);
+        cmax = glm::max(cmax, c);
+    }
+    glm::vec3 ext = cmax - cmin;
+    int axis = (ext.x > ext.y && ext.x > ext.z) ? 0 : (ext.y > ext.z ? 1 : 2);
+    uint32_t half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+                     [&](const Item &a, const Item &b){
+                         return a.sphere[axis] < b.sphere[axis];
+                     });
+
+    uint32_t left = build_node(items, first, half, depth + 1);
+    uint32_t right = build_node(items, first + half, count - half, depth + 1);
+    nodes[id].left = left;
+    nodes[id].right = right;
+    return id;
+}
+
+void CubeBVH::refit(const SceneSoA &scene, ThreadPool &pool){
+    spread = scene.cached_spread;
+    pool.parallel_for(0, order.size(), 4096, 1, [&](size_t b, size_t e, unsigned){
+        for(size_t k = b; k < e; k++){
+            uint32_t i = order[k];
+            spheres[k] = glm::vec4(scene.px[i], scene.py[i], scene.pz[i], spheres[k].w);
+        }
+    });
+    // deepest level first, so children are always up to date
+    for(size_t d = levels.size(); d-- > 0;){
+        const std::vector<uint32_t> &level = levels[d];
+        pool.parallel_for(0, level.size(), 64, 1, [&](size_t b, size_t e, unsigned){
+            for(size_t k = b; k < e; k++){
+                fit_node(nodes[level[k]]);
+            }
+        });
+    }
+}
+
+size_t CubeBVH::cull(const Frustum &frustum, uint32_t *out) const {
+    visited = 0;
+    if(nodes.empty()){
+        return 0;
+    }
+
+    // (node, planes still straddled); a plane the box is fully inside of
+    // stays satisfied for the whole subtree
+    struct Entry {
+        uint32_t node;
+        unsigned mask;
+    };
+    Entry stack[64];
+    int top = 0;
+    stack[top++] = {0, 0x3f};
+    size_t n = 0;
+
+    while(top > 0){
+        Entry en = stack[--top];
+        const Node &node = nodes[en.node];
+        visited++;
+
+        unsigned mask = en.mask;
+        bool outside = false;
+        for(int p = 0; p < 6 && !outside; p++){
+            if(!(mask & (1u << p))){
+                continue;
+            }
+            const glm::vec4 &pl = frustum.planes[p];
+            // corner furthest along the normal, and the opposite one
+            glm::vec3 pv(pl.x >= 0.f ? node.max.x : node.min.x,
+                         pl.y >= 0.f ? node.max.y : node.min.y,
+                         pl.z >= 0.f ? node.max.z : node.min.z);
+            glm::vec3 nv(pl.x >= 0.f ? node.min.x : node.max.x,
+                         pl.y >= 0.f ? node.min.y : node.max.y,
+                         pl.z >= 0.f ? node.min.z : node.max.z);
+            if(!(glm::dot(glm::vec3(pl), pv) + pl.w >= 0.f)){
+                outside = true;
+            }
+            else if(glm::dot(glm::vec3(pl), nv) + pl.w >= 0.f){
+                mask &= ~(1u << p);
+            }
+        }
+        if(outside){
+            continue;
+        }
+
+        if(mask == 0){
+            // fully inside: the whole subtree is visible
+            std::copy(order.begin() + node.first, order.begin() + node.first + node.count, out + n);
+            n += node.count;
+        }
+        else if(node.left == 0){
+            for(uint32_t k = node.first; k < node.first + node.count; k++){
+                glm::vec3 c(spheres[k]);
+                float r = spheres[k].w;
+                bool vis = true;
+                for(int p = 0; p < 6 && vis; p++){
+                    const glm::vec4 &pl = frustum.planes[p];
+                    vis = !(mask & (1u << p)) || pl.x * c.x + pl.y * c.y + pl.z * c.z + pl.w >= -r;
+                }
+                if(vis){
+                    out[n++] = order[k];
+                }
+            }
+        }
+        else{
+            stack[top++] = {node.right, mask};
+            stack[top++] = {node.left, mask};
+        }
+    }
+    return n;
+}
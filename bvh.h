@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "cubeTransforms.h"
+#include "frustum.h"
+#include "threadPool.h"
+
+#include <cstdint>
+#include <vector>
+
+#define BVH_LEAF_SIZE 32
+
+/**
+ * Bounding volume hierarchy over the bounding spheres of a range of cubes,
+ * used for hierarchical frustum culling: a node completely inside the
+ * frustum emits its whole subtree without further tests, a node completely
+ * outside is skipped.
+ *
+ * The build sorts the cube indices so every node covers a contiguous range
+ * of `order`. Centres come from the scene cache and scale with spread while
+ * radii do not, so a change of spread only needs a refit: the centres are
+ * reloaded from the cache and the boxes refitted level by level on the pool.
+ */
+class CubeBVH {
+public:
+    struct Node {
+        glm::vec3 min, max;
+        uint32_t first, count;  // range of order[] covered by the subtree
+        uint32_t left, right;   // children, 0 for leaves (the root is never a child)
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;
+    // bounding sphere of order[k] at the current spread (xyz) and its radius
+    // (w), in tree order so leaves read them contiguously
+    std::vector<glm::vec4> spheres;
+
+    // Range the hierarchy was built for and the spread of the current boxes
+    size_t begin = 0, end = 0;
+    float spread = 0.f;
+
+    // Both read px/py/pz, so the scene cache must be up to date
+    void build(const SceneSoA &scene, size_t begin, size_t end);
+    void refit(const SceneSoA &scene, ThreadPool &pool);
+
+    // Writes the indices of the visible cubes to out, returns how many
+    size_t cull(const Frustum &frustum, uint32_t *out) const;
+
+    // Nodes whose box was tested by the last cull
+    mutable size_t visited = 0;
+
+private:
+    std::vector<std::vector<uint32_t>> levels; // node indices by depth, for the refit
+
+    struct Item {
+        glm::vec4 sphere;
+        uint32_t id;
+    };
+
+    // leaves from their spheres, inner nodes from their children
+    void fit_node(Node &n) const;
+    uint32_t build_node(std::vector<Item> &items, uint32_t first, uint32_t count, size_t depth);
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Counter-based random numbers: every value is a pure function of
+ * (seed, index, draw), so element i of the scene can be generated on any
+ * thread and in any order, always with the same result for the same seed.
+ * The mixing function is the SplitMix64 finalizer.
+ */
+class CounterRng {
+public:
+    explicit CounterRng(uint64_t seed = 1) : key(mix(seed)) {}
+
+    // The draw-th 32-bit number of element index (up to 16 draws per element)
+    uint32_t operator()(uint64_t index, uint32_t draw) const {
+        return (uint32_t)(mix(key + (index * 16 + draw)) >> 32);
+    }
+
+    // Uniform in [0, n)
+    uint32_t below(uint64_t index, uint32_t draw, uint32_t n) const {
+        return (uint32_t)(((uint64_t)(*this)(index, draw) * n) >> 32);
+    }
+
+private:
+    uint64_t key;
+
+    static uint64_t mix(uint64_t z){
+        z += 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+};
@@ -0,0 +1,416 @@
+#include "cubeTransforms.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRANSFORM_X86 1
+#endif
+
+void SceneSoA::resize(size_t n){
+    // reserve first, a plain resize past the capacity would double it
+    for(aligned_vector<float> *a : {&tx, &ty, &tz, &sx, &sy, &sz, &rx, &ry, &rz, &px, &py, &pz}){
+        if(n > a -> capacity()){
+            a -> reserve(n);
+        }
+        a -> resize(n);
+    }
+    dirty = true;
+}
+
+size_t SceneSoA::bytes() const {
+    return 12 * tx.capacity() * sizeof(float);
+}
+
+void SceneSoA::store(size_t i, const glm::vec3 &t, const glm::vec3 &s, const glm::vec3 &r){
+    tx[i] = t.x; ty[i] = t.y; tz[i] = t.z;
+    sx[i] = s.x; sy[i] = s.y; sz[i] = s.z;
+    rx[i] = r.x; ry[i] = r.y; rz[i] = r.z;
+}
+
+void SceneSoA::set(size_t i, const glm::vec3 &t, const glm::vec3 &s, const glm::vec3 &r){
+    store(i, t, s, r);
+    dirty = true;
+}
+
+void SceneSoA::update_cache(size_t begin, size_t end, float spread){
+    for(size_t i = begin; i < end; i++){
+        px[i] = sx[i] * spread * tx[i];
+        py[i] = sy[i] * spread * ty[i];
+        pz[i] = sz[i] * spread * tz[i];
+    }
+}
+
+/*
+ * Closed form of scale(S) * translate(spread * T) * rotate(a, axis):
+ * the upper 3x3 is the Rodrigues rotation with row r multiplied by S[r],
+ * the last column is S * spread * T, read from the scene cache. The normal
+ * matrix, if wanted, is the same rotation with row r divided by S[r]
+ */
+static inline void build_scalar(const SceneSoA &scene, size_t i, float cos_a, float sin_a, glm::mat4 &m, glm::mat3 *n){
+    float omc = 1.f - cos_a;
+    float x = scene.rx[i], y = scene.ry[i], z = scene.rz[i];
+    float sx = scene.sx[i], sy = scene.sy[i], sz = scene.sz[i];
+    float tmpx = omc * x, tmpy = omc * y, tmpz = omc * z;
+
+    // rotation, column by column
+    float r00 = cos_a + tmpx * x, r01 = tmpx * y + sin_a * z, r02 = tmpx * z - sin_a * y;
+    float r10 = tmpy * x - sin_a * z, r11 = cos_a + tmpy * y, r12 = tmpy * z + sin_a * x;
+    float r20 = tmpz * x + sin_a * y, r21 = tmpz * y - sin_a * x, r22 = cos_a + tmpz * z;
+
+    m[0] = glm::vec4(sx * r00, sy * r01, sz * r02, 0.f);
+    m[1] = glm::vec4(sx * r10, sy * r11, sz * r12, 0.f);
+    m[2] = glm::vec4(sx * r20, sy * r21, sz * r22, 0.f);
+    m[3] = glm::vec4(scene.px[i], scene.py[i], scene.pz[i], 1.f);
+
+    if(n){
+        float ix, iy, iz;
+        if(sx == sy && sx == sz){
+            ix = iy = iz = 1.f / sx;
+        }
+        else{
+            ix = 1.f / sx; iy = 1.f / sy; iz = 1.f / sz;
+        }
+        (*n)[0] = glm::vec3(ix * r00, iy * r01, iz * r02);
+        (*n)[1] = glm::vec3(ix * r10, iy * r11, iz * r12);
+        (*n)[2] = glm::vec3(ix * r20, iy * r21, iz * r22);
+    }
+}
+
+void transform_scalar(const SceneSoA &scene, size_t begin, size_t end,
+                      float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals){
+    for(size_t i = begin; i < end; i++){
+        build_scalar(scene, i, cos_a, sin_a, out[i], normals ? normals + i : nullptr);
+    }
+}
+
+void transform_gather_scalar(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                             float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals){
+    for(size_t k = 0; k < count; k++){
+        build_scalar(scene, idx[k], cos_a, sin_a, out[k], normals ? normals + k : nullptr);
+    }
+}
+
+#ifdef TRANSFORM_X86
+
+// Transposes one matrix column held as 4 registers x 4 cubes into the 4 matrices
+static inline void store_column(__m128 r0, __m128 r1, __m128 r2, __m128 r3, glm::mat4 *out, int col){
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(&out[0][col][0], r0);
+    _mm_storeu_ps(&out[1][col][0], r1);
+    _mm_storeu_ps(&out[2][col][0], r2);
+    _mm_storeu_ps(&out[3][col][0], r3);
+}
+
+// Writes the normal matrices of 4 cubes from 9 registers, n[3 * col + row].
+// A mat3 is 9 packed floats: two 4 float stores and one scalar per cube
+static inline void store_normals(const __m128 *n, glm::mat3 *out){
+    __m128 a0 = n[0], a1 = n[1], a2 = n[2], a3 = n[3];
+    __m128 b0 = n[4], b1 = n[5], b2 = n[6], b3 = n[7];
+    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+    _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+    alignas(16) float last[4];
+    _mm_store_ps(last, n[8]);
+    __m128 a[4] = {a0, a1, a2, a3}, b[4] = {b0, b1, b2, b3};
+    for(int j = 0; j < 4; j++){
+        float *d = &out[j][0][0];
+        _mm_storeu_ps(d, a[j]);
+        _mm_storeu_ps(d + 4, b[j]);
+        d[8] = last[j];
+    }
+}
+
+// The 9 inputs of 4 cubes (cached translation, scale, axis), one component per register
+struct Cubes4 {
+    __m128 px, py, pz, sx, sy, sz, x, y, z;
+};
+
+static inline void build_sse2(const Cubes4 &in, __m128 c, __m128 s, __m128 omc, glm::mat4 *out, glm::mat3 *normals){
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    __m128 tmpx = _mm_mul_ps(omc, in.x);
+    __m128 tmpy = _mm_mul_ps(omc, in.y);
+    __m128 tmpz = _mm_mul_ps(omc, in.z);
+    __m128 sinx = _mm_mul_ps(s, in.x);
+    __m128 siny = _mm_mul_ps(s, in.y);
+    __m128 sinz = _mm_mul_ps(s, in.z);
+
+    // rotation, r[3 * col + row]
+    __m128 r[9] = {
+        _mm_add_ps(c, _mm_mul_ps(tmpx, in.x)), _mm_add_ps(_mm_mul_ps(tmpx, in.y), sinz), _mm_sub_ps(_mm_mul_ps(tmpx, in.z), siny),
+        _mm_sub_ps(_mm_mul_ps(tmpy, in.x), sinz), _mm_add_ps(c, _mm_mul_ps(tmpy, in.y)), _mm_add_ps(_mm_mul_ps(tmpy, in.z), sinx),
+        _mm_add_ps(_mm_mul_ps(tmpz, in.x), siny), _mm_sub_ps(_mm_mul_ps(tmpz, in.y), sinx), _mm_add_ps(c, _mm_mul_ps(tmpz, in.z))
+    };
+    for(int col = 0; col < 3; col++){
+        store_column(_mm_mul_ps(in.sx, r[3 * col]), _mm_mul_ps(in.sy, r[3 * col + 1]), _mm_mul_ps(in.sz, r[3 * col + 2]),
+                     zero, out, col);
+    }
+    store_column(in.px, in.py, in.pz, one, out, 3);
+
+    if(normals){
+        // every generated cube is scaled uniformly: one division for the 4
+        __m128 ix, iy, iz;
+        __m128 uniform = _mm_and_ps(_mm_cmpeq_ps(in.sx, in.sy), _mm_cmpeq_ps(in.sx, in.sz));
+        if(_mm_movemask_ps(uniform) == 0xF){
+            ix = iy = iz = _mm_div_ps(one, in.sx);
+        }
+        else{
+            ix = _mm_div_ps(one, in.sx); iy = _mm_div_ps(one, in.sy); iz = _mm_div_ps(one, in.sz);
+        }
+        __m128 n[9];
+        for(int col = 0; col < 3; col++){
+            n[3 * col] = _mm_mul_ps(ix, r[3 * col]);
+            n[3 * col + 1] = _mm_mul_ps(iy, r[3 * col + 1]);
+            n[3 * col + 2] = _mm_mul_ps(iz, r[3 * col + 2]);
+        }
+        store_normals(n, normals);
+    }
+}
+
+static void transform_sse2(const SceneSoA &scene, size_t begin, size_t end,
+                           float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals){
+    const __m128 c = _mm_set1_ps(cos_a);
+    const __m128 s = _mm_set1_ps(sin_a);
+    const __m128 omc = _mm_set1_ps(1.f - cos_a);
+
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4){
+        Cubes4 in;
+        in.px = _mm_loadu_ps(&scene.px[i]);
+        in.py = _mm_loadu_ps(&scene.py[i]);
+        in.pz = _mm_loadu_ps(&scene.pz[i]);
+        in.sx = _mm_loadu_ps(&scene.sx[i]);
+        in.sy = _mm_loadu_ps(&scene.sy[i]);
+        in.sz = _mm_loadu_ps(&scene.sz[i]);
+        in.x = _mm_loadu_ps(&scene.rx[i]);
+        in.y = _mm_loadu_ps(&scene.ry[i]);
+        in.z = _mm_loadu_ps(&scene.rz[i]);
+        build_sse2(in, c, s, omc, out + i, normals ? normals + i : nullptr);
+    }
+    transform_scalar(scene, i, end, cos_a, sin_a, out, normals);
+}
+
+static inline __m128 gather4(const aligned_vector<float> &v, const uint32_t *idx){
+    return _mm_setr_ps(v[idx[0]], v[idx[1]], v[idx[2]], v[idx[3]]);
+}
+
+static void transform_gather_sse2(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                                  float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals){
+    const __m128 c = _mm_set1_ps(cos_a);
+    const __m128 s = _mm_set1_ps(sin_a);
+    const __m128 omc = _mm_set1_ps(1.f - cos_a);
+
+    size_t k = 0;
+    for(; k + 4 <= count; k += 4){
+        Cubes4 in;
+        in.px = gather4(scene.px, idx + k);
+        in.py = gather4(scene.py, idx + k);
+        in.pz = gather4(scene.pz, idx + k);
+        in.sx = gather4(scene.sx, idx + k);
+        in.sy = gather4(scene.sy, idx + k);
+        in.sz = gather4(scene.sz, idx + k);
+        in.x = gather4(scene.rx, idx + k);
+        in.y = gather4(scene.ry, idx + k);
+        in.z = gather4(scene.rz, idx + k);
+        build_sse2(in, c, s, omc, out + k, normals ? normals + k : nullptr);
+    }
+    transform_gather_scalar(scene, idx + k, count - k, cos_a, sin_a, out + k, normals ? normals + k : nullptr);
+}
+
+// Same as store_column, for 8 cubes: each 128-bit half is transposed on its own
+__attribute__((target("avx2")))
+static inline void store_column8(__m256 r0, __m256 r1, __m256 r2, __m256 r3, glm::mat4 *out, int col){
+    __m128 a0 = _mm256_castps256_ps128(r0), b0 = _mm256_extractf128_ps(r0, 1);
+    __m128 a1 = _mm256_castps256_ps128(r1), b1 = _mm256_extractf128_ps(r1, 1);
+    __m128 a2 = _mm256_castps256_ps128(r2), b2 = _mm256_extractf128_ps(r2, 1);
+    __m128 a3 = _mm256_castps256_ps128(r3), b3 = _mm256_extractf128_ps(r3, 1);
+    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+    _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+    _mm_storeu_ps(&out[0][col][0], a0);
+    _mm_storeu_ps(&out[1][col][0], a1);
+    _mm_storeu_ps(&out[2][col][0], a2);
+    _mm_storeu_ps(&out[3][col][0], a3);
+    _mm_storeu_ps(&out[4][col][0], b0);
+    _mm_storeu_ps(&out[5][col][0], b1);
+    _mm_storeu_ps(&out[6][col][0], b2);
+    _mm_storeu_ps(&out[7][col][0], b3);
+}
+
+// Same as store_normals, for 8 cubes, one 128-bit half at a time
+__attribute__((target("avx2")))
+static inline void store_normals8(const __m256 *n, glm::mat3 *out){
+    __m128 lo[9], hi[9];
+    for(int e = 0; e < 9; e++){
+        lo[e] = _mm256_castps256_ps128(n[e]);
+        hi[e] = _mm256_extractf128_ps(n[e], 1);
+    }
+    store_normals(lo, out);
+    store_normals(hi, out + 4);
+}
+
+struct Cubes8 {
+    __m256 px, py, pz, sx, sy, sz, x, y, z;
+};
+
+__attribute__((target("avx2")))
+static inline void build_avx2(const Cubes8 &in, __m256 c, __m256 s, __m256 omc, glm::mat4 *out, glm::mat3 *normals){
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    __m256 tmpx = _mm256_mul_ps(omc, in.x);
+    __m256 tmpy = _mm256_mul_ps(omc, in.y);
+    __m256 tmpz = _mm256_mul_ps(omc, in.z);
+    __m256 sinx = _mm256_mul_ps(s, in.x);
+    __m256 siny = _mm256_mul_ps(s, in.y);
+    __m256 sinz = _mm256_mul_ps(s, in.z);
+
+    __m256 r[9] = {
+        _mm256_add_ps(c, _mm256_mul_ps(tmpx, in.x)), _mm256_add_ps(_mm256_mul_ps(tmpx, in.y), sinz),
+        _mm256_sub_ps(_mm256_mul_ps(tmpx, in.z), siny),
+        _mm256_sub_ps(_mm256_mul_ps(tmpy, in.x), sinz), _mm256_add_ps(c, _mm256_mul_ps(tmpy, in.y)),
+        _mm256_add_ps(_mm256_mul_ps(tmpy, in.z), sinx),
+        _mm256_add_ps(_mm256_mul_ps(tmpz, in.x), siny), _mm256_sub_ps(_mm256_mul_ps(tmpz, in.y), sinx),
+        _mm256_add_ps(c, _mm256_mul_ps(tmpz, in.z))
+    };
+    for(int col = 0; col < 3; col++){
+        store_column8(_mm256_mul_ps(in.sx, r[3 * col]), _mm256_mul_ps(in.sy, r[3 * col + 1]),
+                      _mm256_mul_ps(in.sz, r[3 * col + 2]), zero, out, col);
+    }
+    store_column8(in.px, in.py, in.pz, one, out, 3);
+
+    if(normals){
+        __m256 ix, iy, iz;
+        __m256 uniform = _mm256_and_ps(_mm256_cmp_ps(in.sx, in.sy, _CMP_EQ_OQ), _mm256_cmp_ps(in.sx, in.sz, _CMP_EQ_OQ));
+        if(_mm256_movemask_ps(uniform) == 0xFF){
+            ix = iy = iz = _mm256_div_ps(one, in.sx);
+        }
+        else{
+            ix = _mm256_div_ps(one, in.sx); iy = _mm256_div_ps(one, in.sy); iz = _mm256_div_ps(one, in.sz);
+        }
+        __m256 n[9];
+        for(int col = 0; col < 3; col++){
+            n[3 * col] = _mm256_mul_ps(ix, r[3 * col]);
+            n[3 * col + 1] = _mm256_mul_ps(iy, r[3 * col + 1]);
+            n[3 * col + 2] = _mm256_mul_ps(iz, r[3 * col + 2]);
+        }
+        store_normals8(n, normals);
+    }
+}
+
+__attribute__((target("avx2")))
+static void transform_avx2(const SceneSoA &scene, size_t begin, size_t end,
+                           float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals){
+    const __m256 c = _mm256_set1_ps(cos_a);
+    const __m256 s = _mm256_set1_ps(sin_a);
+    const __m256 omc = _mm256_set1_ps(1.f - cos_a);
+
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8){
+        Cubes8 in;
+        in.px = _mm256_loadu_ps(&scene.px[i]);
+        in.py = _mm256_loadu_ps(&scene.py[i]);
+        in.pz = _mm256_loadu_ps(&scene.pz[i]);
+        in.sx = _mm256_loadu_ps(&scene.sx[i]);
+        in.sy = _mm256_loadu_ps(&scene.sy[i]);
+        in.sz = _mm256_loadu_ps(&scene.sz[i]);
+        in.x = _mm256_loadu_ps(&scene.rx[i]);
+        in.y = _mm256_loadu_ps(&scene.ry[i]);
+        in.z = _mm256_loadu_ps(&scene.rz[i]);
+        build_avx2(in, c, s, omc, out + i, normals ? normals + i : nullptr);
+    }
+    transform_sse2(scene, i, end, cos_a, sin_a, out, normals);
+}
+
+__attribute__((target("avx2")))
+static void transform_gather_avx2(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                                  float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals){
+    const __m256 c = _mm256_set1_ps(cos_a);
+    const __m256 s = _mm256_set1_ps(sin_a);
+    const __m256 omc = _mm256_set1_ps(1.f - cos_a);
+
+    size_t k = 0;
+    for(; k + 8 <= count; k += 8){
+        __m256i vi = _mm256_loadu_si256((const __m256i*)(idx + k));
+        Cubes8 in;
+        in.px = _mm256_i32gather_ps(scene.px.data(), vi, 4);
+        in.py = _mm256_i32gather_ps(scene.py.data(), vi, 4);
+        in.pz = _mm256_i32gather_ps(scene.pz.data(), vi, 4);
+        in.sx = _mm256_i32gather_ps(scene.sx.data(), vi, 4);
+        in.sy = _mm256_i32gather_ps(scene.sy.data(), vi, 4);
+        in.sz = _mm256_i32gather_ps(scene.sz.data(), vi, 4);
+        in.x = _mm256_i32gather_ps(scene.rx.data(), vi, 4);
+        in.y = _mm256_i32gather_ps(scene.ry.data(), vi, 4);
+        in.z = _mm256_i32gather_ps(scene.rz.data(), vi, 4);
+        build_avx2(in, c, s, omc, out + k, normals ? normals + k : nullptr);
+    }
+    transform_gather_sse2(scene, idx + k, count - k, cos_a, sin_a, out + k, normals ? normals + k : nullptr);
+}
+
+#endif
+
+TransformKernels select_transform_kernel(){
+    TransformKernels k = {transform_scalar, transform_gather_scalar, "scalar"};
+#ifdef TRANSFORM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        k = {transform_avx2, transform_gather_avx2, "avx2"};
+    }
+    else if(__builtin_cpu_supports("sse2")){
+        k = {transform_sse2, transform_gather_sse2, "sse2"};
+    }
+#endif
+    return k;
+}
+
+float check_transform_kernel(const TransformKernels &kernel, const SceneSoA &scene,
+                             size_t n, float spread, float angle){
+    n = std::min(n, scene.size());
+    std::vector<glm::mat4> out(n), gathered(n);
+    std::vector<glm::mat3> normals(n), gathered_normals(n);
+    kernel.range(scene, 0, n, std::cos(angle), std::sin(angle), out.data(), normals.data());
+    // the gather variant walks the same cubes backwards
+    std::vector<uint32_t> idx(n);
+    for(size_t i = 0; i < n; i++){
+        idx[i] = (uint32_t)(n - 1 - i);
+    }
+    kernel.gather(scene, idx.data(), n, std::cos(angle), std::sin(angle), gathered.data(), gathered_normals.data());
+
+    float max_err = 0.f, normal_err = 0.f;
+    for(size_t i = 0; i < n; i++){
+        glm::vec3 t(scene.tx[i], scene.ty[i], scene.tz[i]);
+        glm::vec3 s(scene.sx[i], scene.sy[i], scene.sz[i]);
+        glm::vec3 r(scene.rx[i], scene.ry[i], scene.rz[i]);
+        // a zero rotation axis yields NaNs on both paths
+        if(glm::dot(r, r) == 0.f){
+            continue;
+        }
+
+        glm::mat4 ref = glm::mat4(1.0f);
+        ref = glm::scale(ref, s);
+        ref = glm::translate(ref, spread * t);
+        ref = glm::rotate(ref, angle, r);
+
+        for(int c = 0; c < 4; c++){
+            for(int j = 0; j < 4; j++){
+                max_err = std::max(max_err, std::abs(ref[c][j] - out[i][c][j]));
+                max_err = std::max(max_err, std::abs(ref[c][j] - gathered[n - 1 - i][c][j]));
+            }
+        }
+        glm::mat3 normal_ref = glm::transpose(glm::inverse(glm::mat3(ref)));
+        for(int c = 0; c < 3; c++){
+            for(int j = 0; j < 3; j++){
+                normal_err = std::max(normal_err, std::abs(normal_ref[c][j] - normals[i][c][j]));
+                normal_err = std::max(normal_err, std::abs(normal_ref[c][j] - gathered_normals[n - 1 - i][c][j]));
+            }
+        }
+    }
+
+    std::cout << "[Transform] " << kernel.name << " kernel, max error vs glm on " << n << " cubes: " << max_err
+              << " (normal matrices " << normal_err << ")" << std::endl;
+    return std::max(max_err, normal_err);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "alignedAllocator.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Structure-of-arrays copy of the cube field (tr, sc, rot), so the transform
+// kernels can load the same component of 4 or 8 cubes with a single load.
+// Arrays are cache line aligned so worker chunks never share a line.
+struct SceneSoA {
+    aligned_vector<float> tx, ty, tz;  // translation (before spread)
+    aligned_vector<float> sx, sy, sz;  // scale
+    aligned_vector<float> rx, ry, rz;  // rotation axis, normalized
+
+    // Cached static part of every matrix, the translation column sc * spread * tr.
+    // Only the rotation depends on time, so the kernels read this instead of tr;
+    // it is recomputed only when spread changes or set() touches tr/sc
+    aligned_vector<float> px, py, pz;
+    float cached_spread = 0.f;
+    bool dirty = true;
+
+    size_t size() const { return tx.size(); }
+    // Grows (or shrinks) every array to exactly n cubes, keeping the existing ones
+    void resize(size_t n);
+    size_t bytes() const;
+    void set(size_t i, const glm::vec3 &t, const glm::vec3 &s, const glm::vec3 &r);
+    // Same without marking the cache stale, for filling a scene right after resize() (safe from many threads)
+    void store(size_t i, const glm::vec3 &t, const glm::vec3 &s, const glm::vec3 &r);
+
+    bool cache_stale(float spread) const { return dirty || cached_spread != spread; }
+    // Recomputes px/py/pz in [begin, end), then mark_cached once every range is done
+    void update_cache(size_t begin, size_t end, float spread);
+    void mark_cached(float spread) { cached_spread = spread; dirty = false; }
+};
+
+/**
+ * Writes out[i] = scale(sc[i]) * translate(spread * tr[i]) * rotate(angle, rot[i])
+ * for every i in [begin, end), in closed form, with the translation column taken
+ * from the scene cache (which must be up to date for the wanted spread). Every
+ * cube shares the same angle, so its cosine/sine are computed once by the caller.
+ * If normals is not null, normals[i] gets the normal matrix too,
+ * transpose(inverse(mat3(out[i]))): the upper 3x3 is diag(S) * R, so that is
+ * diag(1 / S) * R, built from the same rotation terms. A uniform scale, which
+ * every generated cube has, takes a single reciprocal.
+ */
+typedef void (*TransformKernel)(const SceneSoA &scene, size_t begin, size_t end,
+                                float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals);
+
+// Same, for the cubes idx[0..count), written compactly to out[0..count) (and normals[0..count))
+typedef void (*TransformGatherKernel)(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                                      float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals);
+
+struct TransformKernels {
+    TransformKernel range;
+    TransformGatherKernel gather;
+    const char *name;
+};
+
+void transform_scalar(const SceneSoA &scene, size_t begin, size_t end,
+                      float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals);
+void transform_gather_scalar(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                             float cos_a, float sin_a, glm::mat4 *out, glm::mat3 *normals);
+
+// Picks the widest kernels the running CPU supports (AVX2, SSE2 or scalar)
+TransformKernels select_transform_kernel();
+
+// Compares both kernels, normal matrices included, against the glm::scale/translate/rotate
+// chain on the first n cubes, prints the result and returns the max absolute error.
+// The scene cache must have been updated for `spread`
+float check_transform_kernel(const TransformKernels &kernel, const SceneSoA &scene,
+                             size_t n, float spread, float angle);
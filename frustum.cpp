@@ -0,0 +1,147 @@
+#include "frustum.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRUSTUM_X86 1
+#endif
+
+void Frustum::extract(const glm::mat4 &m){
+    // rows of the (column major) matrix
+    glm::vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 r1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 r2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[0] = r3 + r0;
+    planes[1] = r3 - r0;
+    planes[2] = r3 + r1;
+    planes[3] = r3 - r1;
+    planes[4] = r3 + r2;
+    planes[5] = r3 - r2;
+
+    for(glm::vec4 &p : planes){
+        p = p * (1.f / glm::length(glm::vec3(p)));
+    }
+}
+
+bool Frustum::sphere_visible(const glm::vec3 &c, float radius) const {
+    for(const glm::vec4 &p : planes){
+        // written so that NaN centres count as outside, like the SIMD compare
+        if(!(p.x * c.x + p.y * c.y + p.z * c.z + p.w >= -radius)){
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t cull_scalar(const Frustum &frustum, const SceneSoA &scene, size_t begin, size_t end,
+                   uint32_t *out){
+    size_t n = 0;
+    for(size_t i = begin; i < end; i++){
+        glm::vec3 c(scene.px[i], scene.py[i], scene.pz[i]);
+        float r = CUBE_BOUND_RADIUS * std::max(scene.sx[i], std::max(scene.sy[i], scene.sz[i]));
+        if(frustum.sphere_visible(c, r)){
+            out[n++] = (uint32_t)i;
+        }
+    }
+    return n;
+}
+
+#ifdef FRUSTUM_X86
+
+// Appends base + bit for every set bit of the visibility mask
+static inline size_t emit_mask(unsigned mask, size_t base, uint32_t *out){
+    size_t n = 0;
+    while(mask){
+        out[n++] = (uint32_t)(base + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+static size_t cull_sse2(const Frustum &frustum, const SceneSoA &scene, size_t begin, size_t end,
+                        uint32_t *out){
+    const __m128 bound = _mm_set1_ps(-CUBE_BOUND_RADIUS);
+    __m128 px[6], py[6], pz[6], pw[6];
+    for(int p = 0; p < 6; p++){
+        px[p] = _mm_set1_ps(frustum.planes[p].x);
+        py[p] = _mm_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+
+    size_t n = 0;
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4){
+        __m128 sx = _mm_loadu_ps(&scene.sx[i]);
+        __m128 sy = _mm_loadu_ps(&scene.sy[i]);
+        __m128 sz = _mm_loadu_ps(&scene.sz[i]);
+        __m128 cx = _mm_loadu_ps(&scene.px[i]);
+        __m128 cy = _mm_loadu_ps(&scene.py[i]);
+        __m128 cz = _mm_loadu_ps(&scene.pz[i]);
+        // -radius
+        __m128 nr = _mm_mul_ps(bound, _mm_max_ps(sx, _mm_max_ps(sy, sz)));
+
+        __m128 vis = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(int p = 0; p < 6; p++){
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)),
+                                  _mm_add_ps(_mm_mul_ps(pz[p], cz), pw[p]));
+            vis = _mm_and_ps(vis, _mm_cmpge_ps(d, nr));
+        }
+        n += emit_mask(_mm_movemask_ps(vis), i, out + n);
+    }
+    return n + cull_scalar(frustum, scene, i, end, out + n);
+}
+
+__attribute__((target("avx2")))
+static size_t cull_avx2(const Frustum &frustum, const SceneSoA &scene, size_t begin, size_t end,
+                        uint32_t *out){
+    const __m256 bound = _mm256_set1_ps(-CUBE_BOUND_RADIUS);
+    __m256 px[6], py[6], pz[6], pw[6];
+    for(int p = 0; p < 6; p++){
+        px[p] = _mm256_set1_ps(frustum.planes[p].x);
+        py[p] = _mm256_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+
+    size_t n = 0;
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8){
+        __m256 sx = _mm256_loadu_ps(&scene.sx[i]);
+        __m256 sy = _mm256_loadu_ps(&scene.sy[i]);
+        __m256 sz = _mm256_loadu_ps(&scene.sz[i]);
+        __m256 cx = _mm256_loadu_ps(&scene.px[i]);
+        __m256 cy = _mm256_loadu_ps(&scene.py[i]);
+        __m256 cz = _mm256_loadu_ps(&scene.pz[i]);
+        __m256 nr = _mm256_mul_ps(bound, _mm256_max_ps(sx, _mm256_max_ps(sy, sz)));
+
+        __m256 vis = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(int p = 0; p < 6; p++){
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], cx), _mm256_mul_ps(py[p], cy)),
+                                     _mm256_add_ps(_mm256_mul_ps(pz[p], cz), pw[p]));
+            vis = _mm256_and_ps(vis, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+        }
+        n += emit_mask(_mm256_movemask_ps(vis), i, out + n);
+    }
+    return n + cull_sse2(frustum, scene, i, end, out + n);
+}
+
+#endif
+
+CullKernels select_cull_kernel(){
+    CullKernels k = {cull_scalar, "scalar"};
+#ifdef FRUSTUM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        k = {cull_avx2, "avx2"};
+    }
+    else if(__builtin_cpu_supports("sse2")){
+        k = {cull_sse2, "sse2"};
+    }
+#endif
+    return k;
+}
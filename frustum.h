@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "cubeTransforms.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Half diagonal of the unit cube: bounding sphere radius before scaling
+#define CUBE_BOUND_RADIUS 0.8660254f
+
+struct Frustum {
+    // xyz is the normal pointing inside, w the offset; left, right, bottom, top, near, far
+    glm::vec4 planes[6];
+
+    // Gribb-Hartmann extraction from projection * view, planes normalized
+    void extract(const glm::mat4 &view_projection);
+
+    bool sphere_visible(const glm::vec3 &center, float radius) const;
+};
+
+/**
+ * Writes to out the indices in [begin, end) whose bounding sphere (centre
+ * px/py/pz from the scene cache, which must be up to date, radius
+ * CUBE_BOUND_RADIUS * max(sc)) is not completely outside one of the planes.
+ * Returns how many were written; out needs room for end - begin indices.
+ */
+typedef size_t (*CullKernel)(const Frustum &frustum, const SceneSoA &scene, size_t begin, size_t end,
+                             uint32_t *out);
+
+struct CullKernels {
+    CullKernel cull;
+    const char *name;
+};
+
+size_t cull_scalar(const Frustum &frustum, const SceneSoA &scene, size_t begin, size_t end,
+                   uint32_t *out);
+
+// Picks the widest kernel the running CPU supports (AVX2, SSE2 or scalar)
+CullKernels select_cull_kernel();
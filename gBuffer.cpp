@@ -0,0 +1,61 @@
+#include "gBuffer.h"
+#include "glState.h"
+
+#include <iostream>
+
+bool GBuffer::init(int width, int height){
+    destroy();
+    w = width;
+    h = height;
+
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glGenTextures(GBUFFER_TEXTURES, textures);
+
+    const GLenum internal[GBUFFER_TEXTURES] = {GL_RGBA8, GL_RGBA16F, GL_DEPTH24_STENCIL8};
+    const GLenum format[GBUFFER_TEXTURES] = {GL_RGBA, GL_RGBA, GL_DEPTH_STENCIL};
+    const GLenum type[GBUFFER_TEXTURES] = {GL_UNSIGNED_BYTE, GL_HALF_FLOAT, GL_UNSIGNED_INT_24_8};
+    const GLenum attachment[GBUFFER_TEXTURES] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_DEPTH_STENCIL_ATTACHMENT};
+    for(int t = 0; t < GBUFFER_TEXTURES; t++){
+        glBindTexture(GL_TEXTURE_2D, textures[t]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal[t], w, h, 0, format[t], type[t], NULL);
+        // read back with texelFetch, one texel per pixel
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment[t], GL_TEXTURE_2D, textures[t], 0);
+    }
+    GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, buffers);
+
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if(!complete){
+        std::cout << "[GBuffer] framebuffer incomplete at " << w << "x" << h << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glstate.invalidate();
+    return complete;
+}
+
+void GBuffer::destroy(){
+    if(FBO){
+        glDeleteTextures(GBUFFER_TEXTURES, textures);
+        glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+        glstate.invalidate();
+    }
+    w = h = 0;
+}
+
+void GBuffer::begin(const float clear_color[4]){
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    const float unlit[4] = {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, clear_color);
+    glClearBufferfv(GL_COLOR, 1, unlit);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void GBuffer::bind_textures(int first_unit) const {
+    for(int t = 0; t < GBUFFER_TEXTURES; t++){
+        glstate.bind_texture(first_unit + t, GL_TEXTURE_2D, textures[t]);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Attachments of the G-buffer, in the order of the textures
+#define GBUFFER_ALBEDO 0    // RGBA8: albedo, a = specular map intensity
+#define GBUFFER_NORMAL 1    // RGBA16F: world normal, a = 1 when lit, 0 for unlit (emissive) pixels
+#define GBUFFER_DEPTH 2     // DEPTH24_STENCIL8, world position is rebuilt from it
+#define GBUFFER_TEXTURES 3
+
+/**
+ * Render targets of the deferred path. The geometry pass writes albedo,
+ * specular and normal for every pixel, then the lighting passes read them
+ * back per pixel (directional light) and per light volume (point lights).
+ */
+class GBuffer {
+public:
+    unsigned int FBO = 0;
+    unsigned int textures[GBUFFER_TEXTURES] = {};
+
+    // (Re)creates the targets at width x height, returns false if the framebuffer is incomplete
+    bool init(int width, int height);
+    void destroy();
+
+    // Binds the framebuffer and clears it: albedo to the background, normal to "unlit"
+    void begin(const float clear_color[4]);
+    // Binds the textures to units first_unit .. first_unit + GBUFFER_TEXTURES - 1
+    void bind_textures(int first_unit) const;
+
+    int width() const { return w; }
+    int height() const { return h; }
+    size_t bytes() const { return (size_t)w * h * (4 + 8 + 4); }
+
+private:
+    int w = 0, h = 0;
+};
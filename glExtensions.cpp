@@ -0,0 +1,26 @@
+#include "glExtensions.h"
+
+#include "GLFW/glfw3.h"
+
+#include <iostream>
+
+GLExtensions glext;
+
+void load_gl_extensions(){
+    if(glfwExtensionSupported("GL_ARB_buffer_storage")){
+        glext.BufferStorage = (PFN_glBufferStorage)glfwGetProcAddress("glBufferStorage");
+        glext.buffer_storage = glext.BufferStorage != nullptr;
+    }
+
+    if(glfwExtensionSupported("GL_ARB_get_program_binary")){
+        glext.GetProgramBinary = (PFN_glGetProgramBinary)glfwGetProcAddress("glGetProgramBinary");
+        glext.ProgramBinary = (PFN_glProgramBinary)glfwGetProcAddress("glProgramBinary");
+        glext.ProgramParameteri = (PFN_glProgramParameteri)glfwGetProcAddress("glProgramParameteri");
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        glext.program_binary = glext.GetProgramBinary && glext.ProgramBinary && glext.ProgramParameteri && formats > 0;
+    }
+
+    std::cout << "[GL] buffer_storage: " << (glext.buffer_storage ? "yes" : "no")
+              << ", program_binary: " << (glext.program_binary ? "yes" : "no") << std::endl;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glad/glad.h>
+
+/*
+ * glad is generated for plain GL 3.3 core, so the few newer entry points we
+ * can take advantage of are looked up by hand after the context is created.
+ * Every feature has a 3.3 fallback and is only used when its flag is set.
+ */
+
+// ARB_buffer_storage (core in 4.4)
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+typedef void (APIENTRYP PFN_glBufferStorage)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+// ARB_get_program_binary (core in 4.1)
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void (APIENTRYP PFN_glGetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFN_glProgramBinary)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFN_glProgramParameteri)(GLuint program, GLenum pname, GLint value);
+
+struct GLExtensions {
+    bool buffer_storage = false;
+    PFN_glBufferStorage BufferStorage = nullptr;
+
+    // also needs the driver to expose at least one binary format
+    bool program_binary = false;
+    PFN_glGetProgramBinary GetProgramBinary = nullptr;
+    PFN_glProgramBinary ProgramBinary = nullptr;
+    PFN_glProgramParameteri ProgramParameteri = nullptr;
+};
+
+extern GLExtensions glext;
+
+// Needs a current context; fills glext
+void load_gl_extensions();
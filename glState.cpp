@@ -0,0 +1,88 @@
+#include "glState.h"
+
+GLState glstate;
+
+void GLState::invalidate(){
+    program = vao = UNKNOWN;
+    array_buffer = uniform_buffer = texture_buffer = UNKNOWN;
+    for(int u = 0; u < GL_STATE_TEXTURE_UNITS; u++){
+        textures_2d[u] = buffer_textures[u] = samplers[u] = UNKNOWN;
+    }
+    active_unit = -1;
+}
+
+bool GLState::change(GLuint &slot, GLuint value){
+    if(slot == value){
+        elided++;
+        return false;
+    }
+    slot = value;
+    issued++;
+    return true;
+}
+
+void GLState::activate(int unit){
+    if(unit != active_unit){
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit;
+        issued++;
+    }
+}
+
+bool GLState::use_program(GLuint id){
+    if(!change(program, id)){
+        return false;
+    }
+    glUseProgram(id);
+    return true;
+}
+
+bool GLState::bind_vertex_array(GLuint id){
+    if(!change(vao, id)){
+        return false;
+    }
+    glBindVertexArray(id);
+    return true;
+}
+
+bool GLState::bind_buffer(GLenum target, GLuint buffer){
+    GLuint *slot = target == GL_ARRAY_BUFFER ? &array_buffer
+                 : target == GL_UNIFORM_BUFFER ? &uniform_buffer
+                 : target == GL_TEXTURE_BUFFER ? &texture_buffer : nullptr;
+    if(slot && !change(*slot, buffer)){
+        return false;
+    }
+    if(!slot){
+        issued++;
+    }
+    glBindBuffer(target, buffer);
+    return true;
+}
+
+bool GLState::bind_texture(int unit, GLenum target, GLuint texture){
+    GLuint *slot = nullptr;
+    if(unit < GL_STATE_TEXTURE_UNITS){
+        slot = target == GL_TEXTURE_2D ? &textures_2d[unit]
+             : target == GL_TEXTURE_BUFFER ? &buffer_textures[unit] : nullptr;
+    }
+    if(slot && !change(*slot, texture)){
+        return false;
+    }
+    if(!slot){
+        issued++;
+    }
+    activate(unit);
+    glBindTexture(target, texture);
+    return true;
+}
+
+bool GLState::bind_sampler(int unit, GLuint sampler){
+    if(unit < GL_STATE_TEXTURE_UNITS && !change(samplers[unit], sampler)){
+        return false;
+    }
+    if(unit >= GL_STATE_TEXTURE_UNITS){
+        issued++;
+    }
+    glBindSampler(unit, sampler);
+    return true;
+}
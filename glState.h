@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#define GL_STATE_TEXTURE_UNITS 16
+
+/*
+ * Shadow copy of the bindings the frame changes most: program, vertex array,
+ * the buffer targets that are not vertex array state, and per texture unit
+ * the 2D and buffer textures and the sampler. Binds go through here and are
+ * dropped when they would not change anything; each call returns whether it
+ * reached GL. Code that changes these bindings behind its back (init code,
+ * deleting bound objects) calls invalidate() afterwards.
+ */
+class GLState {
+public:
+    GLState() { invalidate(); }
+
+    bool use_program(GLuint program);
+    bool bind_vertex_array(GLuint vao);
+    // GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER and GL_TEXTURE_BUFFER are tracked, other targets always bind
+    bool bind_buffer(GLenum target, GLuint buffer);
+    // GL_TEXTURE_2D and GL_TEXTURE_BUFFER are tracked, the active unit is switched only when needed
+    bool bind_texture(int unit, GLenum target, GLuint texture);
+    bool bind_sampler(int unit, GLuint sampler);
+
+    // Forgets every binding, so the next bind of each is issued
+    void invalidate();
+
+    // Binds (and active unit switches) issued to GL and dropped, since the last reset_counters
+    long long issued = 0;
+    long long elided = 0;
+    void reset_counters() { issued = elided = 0; }
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+
+    GLuint program, vao;
+    GLuint array_buffer, uniform_buffer, texture_buffer;
+    GLuint textures_2d[GL_STATE_TEXTURE_UNITS];
+    GLuint buffer_textures[GL_STATE_TEXTURE_UNITS];
+    GLuint samplers[GL_STATE_TEXTURE_UNITS];
+    int active_unit;
+
+    // True, and slot updated, when value differs from the cached one
+    bool change(GLuint &slot, GLuint value);
+    void activate(int unit);
+};
+
+extern GLState glstate;
@@ -0,0 +1,266 @@
+#include "instancePacking.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACKING_X86 1
+#endif
+
+// Round to nearest even, overflow to infinity, NaN kept quiet
+uint16_t float_to_half(float f){
+    uint32_t x;
+    std::memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t abs = x & 0x7fffffffu;
+
+    if(abs >= 0x7f800000u){
+        return (uint16_t)(sign | 0x7c00u | (abs > 0x7f800000u ? 0x200u : 0u));
+    }
+    if(abs >= 0x477ff000u){
+        // rounds past the largest half
+        return (uint16_t)(sign | 0x7c00u);
+    }
+    if(abs < 0x38800000u){
+        // subnormal half (or zero): align the mantissa with the implicit bit, then round
+        if(abs < 0x33000000u){
+            return (uint16_t)sign;
+        }
+        uint32_t e = abs >> 23;
+        uint32_t m = (abs & 0x7fffffu) | 0x800000u;
+        uint32_t shift = 126 - e;
+        uint32_t half = m >> shift;
+        uint32_t rest = m & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if(rest > mid || (rest == mid && (half & 1u))){
+            half++;
+        }
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = ((abs - 0x38000000u) >> 13);
+    uint32_t rest = abs & 0x1fffu;
+    if(rest > 0x1000u || (rest == 0x1000u && (half & 1u))){
+        half++;
+    }
+    return (uint16_t)(sign | half);
+}
+
+float half_to_float(uint16_t h){
+    uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+    uint32_t e = (h >> 10) & 0x1fu;
+    uint32_t m = h & 0x3ffu;
+    float f;
+    if(e == 0){
+        f = std::ldexp((float)m, -24);
+        uint32_t x;
+        std::memcpy(&x, &f, 4);
+        x |= sign;
+        std::memcpy(&f, &x, 4);
+        return f;
+    }
+    uint32_t x = e == 31 ? sign | 0x7f800000u | (m << 13) : sign | ((e + 112) << 23) | (m << 13);
+    std::memcpy(&f, &x, 4);
+    return f;
+}
+
+// nearest even, like _mm256_cvtps_epi32, so both kernels emit the same bytes
+static inline int16_t to_snorm16(float v){
+    return (int16_t)std::nearbyint(std::max(-1.f, std::min(1.f, v)) * 32767.f);
+}
+
+// rotate(a, axis) is the quaternion (axis * sin(a/2), cos(a/2))
+static inline void pack_one(const SceneSoA &scene, size_t i, float cos_h, float sin_h, PackedInstance &p){
+    p.px = float_to_half(scene.px[i]);
+    p.py = float_to_half(scene.py[i]);
+    p.pz = float_to_half(scene.pz[i]);
+    p.sx = float_to_half(scene.sx[i]);
+    p.sy = float_to_half(scene.sy[i]);
+    p.sz = float_to_half(scene.sz[i]);
+    p.qx = to_snorm16(scene.rx[i] * sin_h);
+    p.qy = to_snorm16(scene.ry[i] * sin_h);
+    p.qz = to_snorm16(scene.rz[i] * sin_h);
+    p.qw = to_snorm16(cos_h);
+}
+
+void pack_scalar(const SceneSoA &scene, size_t begin, size_t end,
+                 float cos_h, float sin_h, PackedInstance *out){
+    for(size_t i = begin; i < end; i++){
+        pack_one(scene, i, cos_h, sin_h, out[i]);
+    }
+}
+
+void pack_gather_scalar(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                        float cos_h, float sin_h, PackedInstance *out){
+    for(size_t k = 0; k < count; k++){
+        pack_one(scene, idx[k], cos_h, sin_h, out[k]);
+    }
+}
+
+#ifdef PACKING_X86
+
+// The 9 inputs of 8 cubes, one component per register
+struct Packed8 {
+    __m256 px, py, pz, sx, sy, sz, x, y, z;
+};
+
+/*
+ * Converts 8 cubes at once and interleaves them with unpacks: P.xyz/S.x end
+ * up as one 64-bit lane per cube, S.yz as one 32-bit lane and the quaternion
+ * as one 64-bit lane, which are then stored at the 20-byte record offsets.
+ */
+__attribute__((target("avx2,f16c")))
+static inline void pack_f16c(const Packed8 &in, __m256 sin_h, __m128i qw, PackedInstance *out){
+    const __m256 snorm = _mm256_set1_ps(32767.f);
+    __m128i hpx = _mm256_cvtps_ph(in.px, _MM_FROUND_TO_NEAREST_INT);
+    __m128i hpy = _mm256_cvtps_ph(in.py, _MM_FROUND_TO_NEAREST_INT);
+    __m128i hpz = _mm256_cvtps_ph(in.pz, _MM_FROUND_TO_NEAREST_INT);
+    __m128i hsx = _mm256_cvtps_ph(in.sx, _MM_FROUND_TO_NEAREST_INT);
+    __m128i hsy = _mm256_cvtps_ph(in.sy, _MM_FROUND_TO_NEAREST_INT);
+    __m128i hsz = _mm256_cvtps_ph(in.sz, _MM_FROUND_TO_NEAREST_INT);
+
+    // the axis is unit length, so axis * sin(a/2) never leaves [-1, 1]
+    __m256i qx32 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(in.x, sin_h), snorm));
+    __m256i qy32 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(in.y, sin_h), snorm));
+    __m256i qz32 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(in.z, sin_h), snorm));
+    __m128i qx = _mm_packs_epi32(_mm256_castsi256_si128(qx32), _mm256_extracti128_si256(qx32, 1));
+    __m128i qy = _mm_packs_epi32(_mm256_castsi256_si128(qy32), _mm256_extracti128_si256(qy32, 1));
+    __m128i qz = _mm_packs_epi32(_mm256_castsi256_si128(qz32), _mm256_extracti128_si256(qz32, 1));
+
+    __m128i a_lo = _mm_unpacklo_epi16(hpx, hpy), a_hi = _mm_unpackhi_epi16(hpx, hpy);
+    __m128i b_lo = _mm_unpacklo_epi16(hpz, hsx), b_hi = _mm_unpackhi_epi16(hpz, hsx);
+    __m128i ps[4] = {_mm_unpacklo_epi32(a_lo, b_lo), _mm_unpackhi_epi32(a_lo, b_lo),
+                     _mm_unpacklo_epi32(a_hi, b_hi), _mm_unpackhi_epi32(a_hi, b_hi)};
+
+    alignas(16) uint32_t yz[8];
+    _mm_store_si128((__m128i*)yz, _mm_unpacklo_epi16(hsy, hsz));
+    _mm_store_si128((__m128i*)(yz + 4), _mm_unpackhi_epi16(hsy, hsz));
+
+    __m128i c_lo = _mm_unpacklo_epi16(qx, qy), c_hi = _mm_unpackhi_epi16(qx, qy);
+    __m128i d_lo = _mm_unpacklo_epi16(qz, qw), d_hi = _mm_unpackhi_epi16(qz, qw);
+    __m128i q[4] = {_mm_unpacklo_epi32(c_lo, d_lo), _mm_unpackhi_epi32(c_lo, d_lo),
+                    _mm_unpacklo_epi32(c_hi, d_hi), _mm_unpackhi_epi32(c_hi, d_hi)};
+
+    for(int pair = 0; pair < 4; pair++){
+        PackedInstance *a = out + 2 * pair, *b = a + 1;
+        _mm_storel_epi64((__m128i*)&a -> px, ps[pair]);
+        _mm_storel_epi64((__m128i*)&b -> px, _mm_unpackhi_epi64(ps[pair], ps[pair]));
+        std::memcpy(&a -> sy, &yz[2 * pair], 4);
+        std::memcpy(&b -> sy, &yz[2 * pair + 1], 4);
+        _mm_storel_epi64((__m128i*)&a -> qx, q[pair]);
+        _mm_storel_epi64((__m128i*)&b -> qx, _mm_unpackhi_epi64(q[pair], q[pair]));
+    }
+}
+
+__attribute__((target("avx2,f16c")))
+static void pack_range_f16c(const SceneSoA &scene, size_t begin, size_t end,
+                            float cos_h, float sin_h, PackedInstance *out){
+    const __m256 s = _mm256_set1_ps(sin_h);
+    const __m128i qw = _mm_set1_epi16(to_snorm16(cos_h));
+
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8){
+        Packed8 in;
+        in.px = _mm256_loadu_ps(&scene.px[i]);
+        in.py = _mm256_loadu_ps(&scene.py[i]);
+        in.pz = _mm256_loadu_ps(&scene.pz[i]);
+        in.sx = _mm256_loadu_ps(&scene.sx[i]);
+        in.sy = _mm256_loadu_ps(&scene.sy[i]);
+        in.sz = _mm256_loadu_ps(&scene.sz[i]);
+        in.x = _mm256_loadu_ps(&scene.rx[i]);
+        in.y = _mm256_loadu_ps(&scene.ry[i]);
+        in.z = _mm256_loadu_ps(&scene.rz[i]);
+        pack_f16c(in, s, qw, out + i);
+    }
+    pack_scalar(scene, i, end, cos_h, sin_h, out);
+}
+
+__attribute__((target("avx2,f16c")))
+static void pack_gather_f16c(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                             float cos_h, float sin_h, PackedInstance *out){
+    const __m256 s = _mm256_set1_ps(sin_h);
+    const __m128i qw = _mm_set1_epi16(to_snorm16(cos_h));
+
+    size_t k = 0;
+    for(; k + 8 <= count; k += 8){
+        __m256i vi = _mm256_loadu_si256((const __m256i*)(idx + k));
+        Packed8 in;
+        in.px = _mm256_i32gather_ps(scene.px.data(), vi, 4);
+        in.py = _mm256_i32gather_ps(scene.py.data(), vi, 4);
+        in.pz = _mm256_i32gather_ps(scene.pz.data(), vi, 4);
+        in.sx = _mm256_i32gather_ps(scene.sx.data(), vi, 4);
+        in.sy = _mm256_i32gather_ps(scene.sy.data(), vi, 4);
+        in.sz = _mm256_i32gather_ps(scene.sz.data(), vi, 4);
+        in.x = _mm256_i32gather_ps(scene.rx.data(), vi, 4);
+        in.y = _mm256_i32gather_ps(scene.ry.data(), vi, 4);
+        in.z = _mm256_i32gather_ps(scene.rz.data(), vi, 4);
+        pack_f16c(in, s, qw, out + k);
+    }
+    pack_gather_scalar(scene, idx + k, count - k, cos_h, sin_h, out + k);
+}
+
+#endif
+
+PackKernels select_pack_kernel(){
+    PackKernels k = {pack_scalar, pack_gather_scalar, "scalar"};
+#ifdef PACKING_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")){
+        k = {pack_range_f16c, pack_gather_f16c, "f16c"};
+    }
+#endif
+    return k;
+}
+
+// What the vertex shader computes for a corner v of the unit cube
+static glm::vec3 decode(const PackedInstance &p, const glm::vec3 &v){
+    glm::vec3 t(half_to_float(p.px), half_to_float(p.py), half_to_float(p.pz));
+    glm::vec3 s(half_to_float(p.sx), half_to_float(p.sy), half_to_float(p.sz));
+    glm::vec4 q(std::max(p.qx / 32767.f, -1.f), std::max(p.qy / 32767.f, -1.f),
+                std::max(p.qz / 32767.f, -1.f), std::max(p.qw / 32767.f, -1.f));
+    q = q * (1.f / std::sqrt(glm::dot(q, q)));
+    glm::vec3 u(q), r = v + 2.f * glm::cross(u, glm::cross(u, v) + q.w * v);
+    return s * r + t;
+}
+
+float check_pack_kernel(const PackKernels &kernel, const SceneSoA &scene,
+                        size_t n, float spread, float angle){
+    n = std::min(n, scene.size());
+    std::vector<PackedInstance> out(n), gathered(n);
+    kernel.range(scene, 0, n, std::cos(angle * .5f), std::sin(angle * .5f), out.data());
+    // the gather variant walks the same cubes backwards
+    std::vector<uint32_t> idx(n);
+    for(size_t i = 0; i < n; i++){
+        idx[i] = (uint32_t)(n - 1 - i);
+    }
+    kernel.gather(scene, idx.data(), n, std::cos(angle * .5f), std::sin(angle * .5f), gathered.data());
+
+    float max_err = 0.f;
+    const glm::vec3 corner(.5f, .5f, .5f);
+    for(size_t i = 0; i < n; i++){
+        glm::vec3 r(scene.rx[i], scene.ry[i], scene.rz[i]);
+        // a zero rotation axis yields NaNs on the glm side
+        if(glm::dot(r, r) == 0.f){
+            continue;
+        }
+        glm::mat4 ref = glm::mat4(1.0f);
+        ref = glm::scale(ref, glm::vec3(scene.sx[i], scene.sy[i], scene.sz[i]));
+        ref = glm::translate(ref, spread * glm::vec3(scene.tx[i], scene.ty[i], scene.tz[i]));
+        ref = glm::rotate(ref, angle, r);
+        glm::vec3 expected(ref * glm::vec4(corner, 1.f));
+
+        for(const PackedInstance *p : {&out[i], &gathered[n - 1 - i]}){
+            glm::vec3 d = decode(*p, corner) - expected;
+            max_err = std::max(max_err, std::max(std::abs(d.x), std::max(std::abs(d.y), std::abs(d.z))));
+        }
+    }
+
+    std::cout << "[Pack] " << kernel.name << " kernel, " << sizeof(PackedInstance) << " bytes per cube, max corner error vs glm on "
+              << n << " cubes: " << max_err << std::endl;
+    return max_err;
+}
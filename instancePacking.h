@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "cubeTransforms.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Compact per-instance format of a cube, 20 bytes instead of a 64 byte mat4.
+ *
+ * The matrix of every cube is scale(S) * translate(spread * T) * rotate(a, axis),
+ * i.e. x -> S * (R * x) + P with P the cached translation column of the scene.
+ * P and S are stored as half floats and R as a unit quaternion in 16-bit snorm;
+ * the vertex shader rebuilds the position and the normal from them. Offsets
+ * are kept 4-byte aligned for the vertex fetch:
+ *   0: P.x P.y P.z S.x   (GL_HALF_FLOAT x4)
+ *   8: S.y S.z           (GL_HALF_FLOAT x2)
+ *  12: q.x q.y q.z q.w   (GL_SHORT x4, normalized)
+ */
+struct PackedInstance {
+    uint16_t px, py, pz, sx;
+    uint16_t sy, sz;
+    int16_t qx, qy, qz, qw;
+};
+static_assert(sizeof(PackedInstance) == 20, "PackedInstance must stay 20 bytes");
+
+// Same shape as the transform kernels; every cube shares the rotation angle,
+// so the cosine/sine of its half are taken once by the caller
+typedef void (*PackKernel)(const SceneSoA &scene, size_t begin, size_t end,
+                           float cos_h, float sin_h, PackedInstance *out);
+typedef void (*PackGatherKernel)(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                                 float cos_h, float sin_h, PackedInstance *out);
+
+struct PackKernels {
+    PackKernel range;
+    PackGatherKernel gather;
+    const char *name;
+};
+
+void pack_scalar(const SceneSoA &scene, size_t begin, size_t end,
+                 float cos_h, float sin_h, PackedInstance *out);
+void pack_gather_scalar(const SceneSoA &scene, const uint32_t *idx, size_t count,
+                        float cos_h, float sin_h, PackedInstance *out);
+
+// F16C + AVX2 when the running CPU has them, scalar otherwise
+PackKernels select_pack_kernel();
+
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+// Decodes both kernels' output like the vertex shader does and compares it
+// with the full matrices on the first n cubes; prints and returns the max
+// absolute error of a transformed cube corner. The scene cache must be up
+// to date for `spread`
+float check_pack_kernel(const PackKernels &kernel, const SceneSoA &scene,
+                        size_t n, float spread, float angle);
@@ -0,0 +1,187 @@
+#include "lightClusters.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// fragment.glsl: attenuation = 1 / (1 + LINEAR d + QUADRATIC d^2)
+#define ATTENUATION_LINEAR 0.07f
+#define ATTENUATION_QUADRATIC 0.017f
+
+float light_radius(float cutoff){
+    if(cutoff <= 0.f){
+        return INFINITY;
+    }
+    if(cutoff >= 1.f){
+        return 0.f;
+    }
+    // QUADRATIC d^2 + LINEAR d + (1 - 1 / cutoff) = 0, positive root
+    float c = 1.f - 1.f / cutoff;
+    float disc = ATTENUATION_LINEAR * ATTENUATION_LINEAR - 4.f * ATTENUATION_QUADRATIC * c;
+    return (-ATTENUATION_LINEAR + std::sqrt(disc)) / (2.f * ATTENUATION_QUADRATIC);
+}
+
+static int tile(float ndc, int tiles){
+    return std::min(tiles - 1, std::max(0, (int)std::floor((ndc * .5f + .5f) * tiles)));
+}
+
+void LightClusters::slice_range(Light &l) const {
+    // view space looks down -z
+    float depth = -l.center.z;
+    float d_min = depth - l.radius, d_max = depth + l.radius;
+    if(d_max < near_z || d_min > far_z){
+        l.z0 = 1; l.z1 = 0;
+        return;
+    }
+    auto slice = [&](float z){
+        int s = (int)std::floor(std::log(z) * slice_scale + slice_bias);
+        return std::min(CLUSTER_Z - 1, std::max(0, s));
+    };
+    l.z0 = slice(std::max(d_min, near_z));
+    l.z1 = slice(std::min(d_max, far_z));
+}
+
+LightClusters::Rect LightClusters::slice_rect(const Light &l, int z) const {
+    Rect r = {0, CLUSTER_X - 1, 0, CLUSTER_Y - 1};
+
+    // The part of the sphere inside slice z: its depths, and the radius of the
+    // widest cross-section, the one nearest to the centre
+    float depth = -l.center.z;
+    float s_near = std::exp((z - slice_bias) / slice_scale);
+    float s_far = std::exp((z + 1 - slice_bias) / slice_scale);
+    float d_min = std::max(depth - l.radius, s_near);
+    float d_max = std::min(depth + l.radius, s_far);
+    if(d_min <= near_z){
+        return r;   // crosses the near plane: its projection is unbounded
+    }
+    float dz = depth < d_min ? d_min - depth : (depth > d_max ? depth - d_max : 0.f);
+    float radius = std::sqrt(std::max(0.f, l.radius * l.radius - dz * dz));
+
+    // Bounds of the projected box around that section: with a symmetric
+    // perspective ndc = P * x / depth, extreme at the nearest or farthest depth
+    float p[2] = {p00, p11};
+    float c[2] = {l.center.x, l.center.y};
+    float lo[2], hi[2];
+    for(int a = 0; a < 2; a++){
+        float x_lo = c[a] - radius, x_hi = c[a] + radius;
+        lo[a] = p[a] * (x_lo < 0.f ? x_lo / d_min : x_lo / d_max);
+        hi[a] = p[a] * (x_hi > 0.f ? x_hi / d_min : x_hi / d_max);
+        if(hi[a] < -1.f || lo[a] > 1.f){
+            r.x0 = 1; r.x1 = 0;
+            return r;
+        }
+    }
+    r.x0 = tile(lo[0], CLUSTER_X); r.x1 = tile(hi[0], CLUSTER_X);
+    r.y0 = tile(lo[1], CLUSTER_Y); r.y1 = tile(hi[1], CLUSTER_Y);
+    return r;
+}
+
+void LightClusters::build(const PointLight *lights, size_t count, const glm::mat4 &view, const glm::mat4 &projection,
+                          float near_plane, float far_plane, ThreadPool &pool){
+    slice_scale = CLUSTER_Z / std::log(far_plane / near_plane);
+    slice_bias = -std::log(near_plane) * slice_scale;
+    p00 = projection[0][0];
+    p11 = projection[1][1];
+    near_z = near_plane;
+    far_z = far_plane;
+
+    view_lights.resize(count);
+    pool.parallel_for(0, count, 1024, 1, [&](size_t b, size_t e, unsigned){
+        for(size_t i = b; i < e; i++){
+            Light &l = view_lights[i];
+            l.center = glm::vec3(view * glm::vec4(glm::vec3(lights[i].position), 1.f));
+            l.radius = lights[i].position.w;
+            slice_range(l);
+        }
+    });
+
+    // Every worker owns whole depth slices, so no two touch the same cluster.
+    // Counts first, kept in the count slot of the grid
+    grid.assign(2 * CLUSTER_COUNT, 0);
+    pool.parallel_for(0, CLUSTER_Z, 1, 1, [&](size_t zb, size_t ze, unsigned){
+        for(size_t i = 0; i < count; i++){
+            const Light &l = view_lights[i];
+            int z0 = std::max(l.z0, (int)zb), z1 = std::min(l.z1, (int)ze - 1);
+            for(int z = z0; z <= z1; z++){
+                Rect r = slice_rect(l, z);
+                for(int y = r.y0; y <= r.y1; y++){
+                    for(int x = r.x0; x <= r.x1; x++){
+                        grid[2 * ((z * CLUSTER_Y + y) * CLUSTER_X + x) + 1]++;
+                    }
+                }
+            }
+        }
+    });
+
+    // then every cluster's range of the index list
+    uint32_t total = 0;
+    cursor.resize(CLUSTER_COUNT);
+    for(int c = 0; c < CLUSTER_COUNT; c++){
+        grid[2 * c] = total;
+        cursor[c] = total;
+        total += grid[2 * c + 1];
+    }
+
+    // and the indices, in light order inside each cluster
+    indices.resize(total);
+    pool.parallel_for(0, CLUSTER_Z, 1, 1, [&](size_t zb, size_t ze, unsigned){
+        for(size_t i = 0; i < count; i++){
+            const Light &l = view_lights[i];
+            int z0 = std::max(l.z0, (int)zb), z1 = std::min(l.z1, (int)ze - 1);
+            for(int z = z0; z <= z1; z++){
+                Rect r = slice_rect(l, z);
+                for(int y = r.y0; y <= r.y1; y++){
+                    for(int x = r.x0; x <= r.x1; x++){
+                        indices[cursor[(z * CLUSTER_Y + y) * CLUSTER_X + x]++] = (uint32_t)i;
+                    }
+                }
+            }
+        }
+    });
+}
+
+size_t check_light_clusters(size_t count, size_t samples, ThreadPool &pool){
+    const float near_plane = .1f, far_plane = 100.f;
+    glm::mat4 view = glm::lookAt(glm::vec3(3.f, 2.f, 5.f), glm::vec3(0.f, 0.f, -20.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, near_plane, far_plane);
+
+    uint64_t state = 7;
+    auto uniform = [&](float lo, float hi){
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return lo + (hi - lo) * (float)((z ^ (z >> 31)) >> 40) / (float)(1ull << 24);
+    };
+
+    std::vector<PointLight> lights(count);
+    float radius = light_radius(.05f);
+    for(PointLight &l : lights){
+        l.position = glm::vec4(uniform(-40.f, 40.f), uniform(-25.f, 25.f), uniform(-90.f, 10.f), radius);
+    }
+    LightClusters clusters;
+    clusters.build(lights.data(), count, view, projection, near_plane, far_plane, pool);
+
+    // fragments spread over the view volume, looked up the way fragment.glsl does
+    glm::mat4 inv_view = glm::inverse(view);
+    size_t missed = 0;
+    for(size_t k = 0; k < samples; k++){
+        float x = uniform(-1.f, 1.f), y = uniform(-1.f, 1.f);
+        float depth = near_plane * std::pow(far_plane / near_plane, uniform(0.f, 1.f));
+        glm::vec3 world(inv_view * glm::vec4(x * depth / projection[0][0], y * depth / projection[1][1], -depth, 1.f));
+        int z = std::min(CLUSTER_Z - 1, std::max(0, (int)std::floor(std::log(depth) * clusters.slice_scale + clusters.slice_bias)));
+        int c = (z * CLUSTER_Y + tile(y, CLUSTER_Y)) * CLUSTER_X + tile(x, CLUSTER_X);
+        const uint32_t *first = clusters.indices.data() + clusters.grid[2 * c];
+        const uint32_t *last = first + clusters.grid[2 * c + 1];
+        for(size_t i = 0; i < count; i++){
+            // the indices of a cluster are in light order
+            if(glm::length(glm::vec3(lights[i].position) - world) <= radius && !std::binary_search(first, last, (uint32_t)i)){
+                missed++;
+            }
+        }
+    }
+    std::cout << "[LightClusters] " << count << " lights, " << samples << " fragments: " << missed
+              << " light-fragment pairs missed by the clusters" << std::endl;
+    return missed;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "threadPool.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Cluster grid: screen tiles x depth slices, the slices spaced exponentially
+// between the near and far plane so they stay roughly cubic in view space
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+// One point light in the light buffer, fetched by fragment.glsl as 4 RGBA32F texels
+struct PointLight {
+    glm::vec4 position;     // xyz, w: radius past which the light is cut off
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+// Distance at which 1 / (1 + 0.07 d + 0.017 d^2), the attenuation used by
+// fragment.glsl, falls to `cutoff`. The shader rescales the attenuation so it
+// reaches 0 there, so no light reaches past its radius
+float light_radius(float cutoff);
+
+/**
+ * CPU light assignment for clustered forward shading. build() bins every
+ * light's bounding sphere into the clusters it overlaps and writes, per
+ * cluster, a range of a compact light index list; fragment.glsl then only
+ * loops over the lights of its own cluster.
+ */
+class LightClusters {
+public:
+    // Per cluster (x fastest, then y, then z): first entry in indices, light count
+    std::vector<uint32_t> grid;
+    std::vector<uint32_t> indices;
+
+    void build(const PointLight *lights, size_t count, const glm::mat4 &view, const glm::mat4 &projection,
+               float near_plane, float far_plane, ThreadPool &pool);
+
+    // Depth slice of view depth z (> 0) is floor(log(z) * slice_scale + slice_bias)
+    float slice_scale = 0.f;
+    float slice_bias = 0.f;
+
+    size_t assignments() const { return indices.size(); }
+
+private:
+    struct Light {
+        glm::vec3 center;   // view space
+        float radius;
+        int z0, z1;         // depth slices overlapped, z0 > z1 when out of view
+    };
+    struct Rect {
+        int x0, x1, y0, y1; // inclusive tile range, x0 > x1 when empty
+    };
+    std::vector<Light> view_lights;
+    std::vector<uint32_t> cursor;
+    float p00 = 0.f, p11 = 0.f;
+    float near_z = 0.f, far_z = 0.f;
+
+    void slice_range(Light &l) const;
+    Rect slice_rect(const Light &l, int z) const;
+};
+
+// Bins `count` random lights, then checks every light within reach of
+// `samples` random fragments is listed in the fragment's cluster; prints and
+// returns the number of missed light-fragment pairs
+size_t check_light_clusters(size_t count, size_t samples, ThreadPool &pool);
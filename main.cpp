@@ -8,7 +8,8 @@ void Engine::framebuffer_size_callback(GLFWwindow* window, int width, int height
     glViewport(0, 0, width, height);
 }
 
-int Engine::init(int cubes, bool imgui, bool save){
+int Engine::init(int cubes, bool imgui, bool save, DrawMode mode, uint64_t seed){
+    auto startup_start = std::chrono::high_resolution_clock::now();
     // INIZIALIZZAZIONE FINESTRA
 
     // GLFW initialization
@@ -35,6 +36,7 @@ int Engine::init(int cubes, bool imgui, bool save){
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    load_gl_extensions();
 
     glViewport(0, 0, WIN_WIDTH, WIN_HEIGHT); // lower-left corner of the window, and dimension
     width = WIN_WIDTH;
@@ -43,28 +45,38 @@ int Engine::init(int cubes, bool imgui, bool save){
 
 
     stbi_set_flip_vertically_on_load(true);
+    pool.start();
+    tracker.initWorkers(pool.size());
     tracker.init(save);
     is_imgui = imgui;
-
-    tr.resize(CUBES);
-    sc.resize(CUBES);
-    rot.resize(CUBES);
-    trans.resize(CUBES);
-
-    cubes_tot = cubes;
-    num_lights = 10;
-
-    // Random variables for cubes
-    for(int i = 0; i < CUBES; i++){
-        tr[i] = std::max((rand() % 1000 * 0.1f), 0.5f) * glm::normalize(glm::vec3(rand() % 10 - 5, rand() % 10 - 5, rand() % 10 - 5));
-        sc[i] = glm::vec3(std::max(rand() % 10 * 0.1f, 0.1f));
-        rot[i] = glm::normalize(glm::vec3(std::min((rand() % 10 - 5) * 0.1f, 0.1f), std::min((rand() % 10 - 5) * 0.1f, 0.1f), std::min((rand() % 10 - 5) * 0.1f, 0.1f)));
-    }
+    draw_mode = mode;
+
+    // a negative count from the command line draws nothing, as in the UI
+    cubes_tot = std::max(0, std::min(CUBES, cubes));
+    num_lights = std::min(10, cubes_tot);
+
+    auto scene_start = std::chrono::high_resolution_clock::now();
+    this -> seed = seed;
+    fit_scene_storage();
+    double scene_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - scene_start).count();
+    transform_kernel = select_transform_kernel();
+    update_scene_cache();
+    check_transform_kernel(transform_kernel, scene, 4096, spread, 1.0f);
+    pack_kernel = select_pack_kernel();
+    check_pack_kernel(pack_kernel, scene, 4096, spread, 1.0f);
+    cull_kernel = select_cull_kernel();
+    check_radix_sort(100000, pool);
+    OcclusionCuller::check(pool);
+    check_light_clusters(512, 20000, pool);
 
     init_shaders();
     init_VAO();
     init_buffers();
     init_textures();
+    // one variant per draw mode for the starting scene, so they count as startup
+    for(CubeVariants &variants : cube_variants){
+        variants.get(cube_defines());
+    }
 
     // Camera initialization
     glm::vec3 pos = glm::vec3(0.0f, 0.0f, 3.0f);
@@ -72,13 +84,129 @@ int Engine::init(int cubes, bool imgui, bool save){
     cam = new Camera(pos, tar, 30.0f, 2.5f);
 
     model_obj = Model("/home/zancanonzanca/Desktop/OpenGL-SC-Analysis---Embedded-systems-project/resources/backpack/backpack.obj");
+    model_obj.resolve_materials(model_shader);
+    model_transform = glm::mat4(1.0f);
+    model_transform = glm::translate(model_transform, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
+    model_transform = glm::scale(model_transform, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
 
     // To disable vsync
     glfwSwapInterval(0);
 
+    // everything above bound objects directly
+    glstate.invalidate();
+
+    tracker.trackStartup(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startup_start).count(), scene_ms,
+                         Shader::build_ms, Shader::cache_hits, Shader::cache_hits + Shader::cache_misses);
     return 0;
 }
 
+void Engine::generate_scene(size_t begin, size_t end){
+    // Random variables for cubes: every cube draws from its own counter, so
+    // the chunks can run on any worker and a seed always gives the same scene,
+    // whether it is generated at once or grown chunk by chunk
+    CounterRng rng(seed);
+    pool.parallel_for(begin, end, 4096, CACHE_LINE / sizeof(float), [&](size_t b, size_t e, unsigned){
+        for(size_t i = b; i < e; i++){
+            auto r = [&](uint32_t draw, uint32_t n){ return (int)rng.below(i, draw, n); };
+            tr[i] = std::max((r(0, 1000) * 0.1f), 0.5f) * glm::normalize(glm::vec3(r(1, 10) - 5, r(2, 10) - 5, r(3, 10) - 5));
+            sc[i] = glm::vec3(std::max(r(4, 10) * 0.1f, 0.1f));
+            rot[i] = glm::normalize(glm::vec3(std::min((r(5, 10) - 5) * 0.1f, 0.1f), std::min((r(6, 10) - 5) * 0.1f, 0.1f), std::min((r(7, 10) - 5) * 0.1f, 0.1f)));
+            scene.store(i, tr[i], sc[i], rot[i]);
+        }
+    });
+}
+
+// Grows a vector to exactly n elements (a plain resize past the capacity would double it)
+template <typename V>
+static void grow_exact(V &v, size_t n){
+    if(n > v.capacity()){
+        v.reserve(n);
+    }
+    if(n > v.size()){
+        v.resize(n);
+    }
+}
+
+void Engine::fit_scene_storage(){
+    // Only called between frames: the pool is idle and the GPU reads the
+    // instance ring, never these arrays, so reallocating them is safe
+    if((size_t)cubes_tot > scene_capacity){
+        size_t old = scene_capacity;
+        scene_capacity = std::min((size_t)CUBES, ((size_t)cubes_tot + SCENE_CHUNK - 1) / SCENE_CHUNK * SCENE_CHUNK);
+        grow_exact(tr, scene_capacity);
+        grow_exact(sc, scene_capacity);
+        grow_exact(rot, scene_capacity);
+        grow_exact(visible, scene_capacity);
+        grow_exact(lod_scratch, scene_capacity);
+        grow_exact(sort_keys, scene_capacity);
+        grow_exact(sort_keys_tmp, scene_capacity);
+        scene.resize(scene_capacity);
+        generate_scene(old, scene_capacity);
+    }
+    // trans[] holds the lights, plus every cube matrix in direct mode only
+    grow_exact(trans, draw_mode == DrawMode::DIRECT ? scene_capacity : (size_t)num_lights);
+    grow_exact(normals, draw_mode == DrawMode::DIRECT ? scene_capacity : 0);
+    tracker.trackSceneMemory(scene_bytes());
+}
+
+size_t Engine::scene_bytes() const {
+    return (tr.capacity() + sc.capacity() + rot.capacity()) * sizeof(glm::vec3)
+         + trans.capacity() * sizeof(glm::mat4)
+         + normals.capacity() * sizeof(glm::mat3)
+         + (visible.capacity() + lod_scratch.capacity() + sort_keys.capacity() + sort_keys_tmp.capacity()) * sizeof(uint32_t)
+         + scene.bytes();
+}
+
+void Engine::run_light_benchmark(){
+    // Sweeps the light count and times the GPU side of draw() with the brute
+    // force light loop and with the clustered one, same camera and cutoff
+    const int counts[] = {16, 64, 256, 1024, 4096};
+    const int warmup = 10, frames = 60;
+    bool was_clustered = clustered_lights;
+    int was_lights = num_lights;
+
+    std::ofstream csv("light_bench.csv");
+    csv << "Lights,BruteForce(ms),Clustered(ms),ClusterBuild(ms),Assignments,\n";
+    for(int n : counts){
+        if(n > cubes_tot || glfwWindowShouldClose(window)){
+            break;
+        }
+        num_lights = n;
+        fit_scene_storage();
+
+        double gpu_ms[2] = {0.0, 0.0}, build_ms = 0.0;
+        long long assignments = 0;
+        for(int clustered = 0; clustered < 2; clustered++){
+            clustered_lights = clustered == 1;
+            for(int f = 0; f < warmup + frames; f++){
+                tracker.beginFrame();
+                frame_time = (float)glfwGetTime();
+                glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                draw();
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+
+                // draw() times itself, the result lags a few frames behind: the warmup covers it
+                if(f >= warmup){
+                    gpu_ms[clustered] += gpu_time / frames;
+                    if(clustered){
+                        build_ms += tracker.lightCullTime / frames;
+                        assignments = tracker.lightAssignments;
+                    }
+                }
+                tracker.endFrame();
+            }
+        }
+        std::cout << "[LightBench] " << n << " lights: brute force " << gpu_ms[0] << "ms, clustered " << gpu_ms[1]
+                  << "ms (build " << build_ms << "ms, " << assignments << " binned)" << std::endl;
+        csv << n << "," << gpu_ms[0] << "," << gpu_ms[1] << "," << build_ms << "," << assignments << ",\n";
+    }
+    clustered_lights = was_clustered;
+    num_lights = was_lights;
+}
+
 void Engine::process_input(){
     // Refreshing the input
     right_input.x = 0;
@@ -127,8 +255,25 @@ void Engine::init_VAO(){
     // glGenVertexArrays(NUM, VAO);
     glGenVertexArrays(1, &cVAO);
     glGenVertexArrays(1, &lightVAO);
+    glGenVertexArrays(1, &impostorVAO);
+    glGenVertexArrays(1, &volumeVAO);
+    glGenVertexArrays(1, &emptyVAO);
 }
 
+// Light volume cube: corners (bit 0 = x, bit 1 = y, bit 2 = z) and faces, counter clockwise from outside
+static const float volume_corners[24] = {
+    -1.f, -1.f, -1.f,   1.f, -1.f, -1.f,  -1.f,  1.f, -1.f,   1.f,  1.f, -1.f,
+    -1.f, -1.f,  1.f,   1.f, -1.f,  1.f,  -1.f,  1.f,  1.f,   1.f,  1.f,  1.f
+};
+static const unsigned int volume_tris[36] = {
+    1, 3, 7,  1, 7, 5,  // +x
+    0, 4, 6,  0, 6, 2,  // -x
+    2, 6, 7,  2, 7, 3,  // +y
+    0, 1, 5,  0, 5, 4,  // -y
+    4, 5, 7,  4, 7, 6,  // +z
+    0, 2, 3,  0, 3, 1   // -z
+};
+
 void Engine::init_buffers(){
     glGenBuffers(1, &cVBO);
     glGenBuffers(1, &cEBO);
@@ -161,20 +306,194 @@ void Engine::init_buffers(){
     glEnableVertexAttribArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cEBO);
 
+    // Instance ring: every frame the model matrices (lights first, then
+    // cubes) are written straight into it, read by attributes 3-6 of both VAOs
+    if(draw_mode == DrawMode::INSTANCED){
+        instance_ring.init(GL_ARRAY_BUFFER, cubes_tot * sizeof(glm::mat4));
+        set_instance_attribs(cVAO, 0);
+        set_instance_attribs(lightVAO, 0);
+    }
+    // Packed: the lights keep their full matrices, the cubes follow as PackedInstance
+    if(draw_mode == DrawMode::PACKED){
+        instance_ring.init(GL_ARRAY_BUFFER, num_lights * sizeof(glm::mat4) + cubes_tot * sizeof(PackedInstance));
+        set_packed_attribs(cVAO, 0);
+        set_instance_attribs(lightVAO, 0);
+    }
+
+    glGenQueries(STREAM_FRAMES, overdraw_queries);
+    glGenQueries(STREAM_FRAMES, gpu_time_queries);
+
+    // Light volumes: a [-1, 1] cube, wound counter clockwise seen from outside
+    // (the cube mesh above is not consistent) so front faces can be culled
+    glBindVertexArray(volumeVAO);
+    glGenBuffers(1, &volumeVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, volumeVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(volume_corners), volume_corners, GL_STATIC_DRAW);
+    tracker.trackVramAllocation(sizeof(volume_corners));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glGenBuffers(1, &volumeEBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, volumeEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(volume_tris), volume_tris, GL_STATIC_DRAW);
+    tracker.trackVramAllocation(sizeof(volume_tris));
+    glBindVertexArray(0);
+
+    // Frame block: camera and directional light for every program, rewritten once per frame
+    glGenBuffers(1, &frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameUBO);
+    tracker.trackVramAllocation(sizeof(FrameBlock));
+
+    // Point lights: read with texelFetch, so their number is not bound by uniform space
+    glGenBuffers(1, &lightTBO);
+    glBindBuffer(GL_TEXTURE_BUFFER, lightTBO);
+    glBufferData(GL_TEXTURE_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
+    glGenTextures(1, &light_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, light_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightTBO);
+
+    // Light clusters: (first, count) per cluster, then the light indices
+    glGenBuffers(2, clusterTBO);
+    glGenTextures(2, cluster_textures);
+    GLenum cluster_formats[2] = {GL_RG32UI, GL_R32UI};
+    for(int t = 0; t < 2; t++){
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterTBO[t]);
+        glBufferData(GL_TEXTURE_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, cluster_textures[t]);
+        glTexBuffer(GL_TEXTURE_BUFFER, cluster_formats[t], clusterTBO[t]);
+    }
+
+    // Static instance data: only changes when more cubes are requested
+    glGenBuffers(1, &staticVBO);
+    if(draw_mode == DrawMode::ANIMATED){
+        upload_static_instances();
+    }
+
     glBindVertexArray(0);
 
 }
 
+void Engine::set_instance_attribs(unsigned int vao, size_t offset){
+    // a mat4 attribute takes four consecutive vec4 locations
+    glstate.bind_vertex_array(vao);
+    glstate.bind_buffer(GL_ARRAY_BUFFER, instance_ring.ID);
+    for(int c = 0; c < 4; c++){
+        glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(offset + c * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(3 + c);
+        glVertexAttribDivisor(3 + c, 1);
+    }
+}
+
+void Engine::set_normal_attribs(unsigned int vao, size_t offset){
+    // a mat3 attribute takes three consecutive vec3 locations
+    glstate.bind_vertex_array(vao);
+    glstate.bind_buffer(GL_ARRAY_BUFFER, instance_ring.ID);
+    for(int c = 0; c < 3; c++){
+        glVertexAttribPointer(7 + c, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat3), (void*)(offset + c * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(7 + c);
+        glVertexAttribDivisor(7 + c, 1);
+    }
+}
+
+void Engine::set_packed_attribs(unsigned int vao, size_t offset){
+    // see PackedInstance: 4 + 2 half floats, then a normalized snorm16 quaternion
+    glstate.bind_vertex_array(vao);
+    glstate.bind_buffer(GL_ARRAY_BUFFER, instance_ring.ID);
+    glVertexAttribPointer(3, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedInstance), (void*)(offset + offsetof(PackedInstance, px)));
+    glVertexAttribPointer(4, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedInstance), (void*)(offset + offsetof(PackedInstance, sy)));
+    glVertexAttribPointer(5, 4, GL_SHORT, GL_TRUE, sizeof(PackedInstance), (void*)(offset + offsetof(PackedInstance, qx)));
+    for(int a = 0; a < 3; a++){
+        glEnableVertexAttribArray(3 + a);
+        glVertexAttribDivisor(3 + a, 1);
+    }
+    glDisableVertexAttribArray(6);
+}
+
+void Engine::set_static_attribs(unsigned int vao, size_t offset){
+    // tr, sc and rot interleaved, 9 floats per cube
+    glstate.bind_vertex_array(vao);
+    glstate.bind_buffer(GL_ARRAY_BUFFER, staticVBO);
+    for(int a = 0; a < 3; a++){
+        glVertexAttribPointer(3 + a, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(offset + a * 3 * sizeof(float)));
+        glEnableVertexAttribArray(3 + a);
+        glVertexAttribDivisor(3 + a, 1);
+    }
+}
+
+void Engine::upload_static_instances(){
+    std::vector<float> data(9 * (size_t)cubes_tot);
+    for(int i = 0; i < cubes_tot; i++){
+        float * d = &data[9 * (size_t)i];
+        d[0] = tr[i].x; d[1] = tr[i].y; d[2] = tr[i].z;
+        d[3] = sc[i].x; d[4] = sc[i].y; d[5] = sc[i].z;
+        d[6] = rot[i].x; d[7] = rot[i].y; d[8] = rot[i].z;
+    }
+
+    long long bytes = (long long)data.size() * sizeof(float);
+    glstate.bind_buffer(GL_ARRAY_BUFFER, staticVBO);
+    glBufferData(GL_ARRAY_BUFFER, bytes, data.data(), GL_STATIC_DRAW);
+    tracker.trackVramDeallocation(9 * sizeof(float) * (long long)static_count);
+    tracker.trackVramAllocation(bytes);
+    tracker.trackDataUpload(bytes);
+    static_count = cubes_tot;
+}
+
 void Engine::init_shaders(){
     // CREAZIONE SHADER
-    shader = Shader("shaders/vertex.glsl", "shaders/fragment.glsl");
     light_shader = Shader("shaders/vertex.glsl", "shaders/fragment_light.glsl");
+    instanced_light_shader = Shader("shaders/vertex_instanced.glsl", "shaders/fragment_light.glsl");
+    animated_light_shader = Shader("shaders/vertex_animated.glsl", "shaders/fragment_light.glsl");
+    impostor_shader = Shader("shaders/vertex_impostor.glsl", "shaders/fragment_impostor.glsl");
+    packed_impostor_shader = Shader("shaders/vertex_impostor_packed.glsl", "shaders/fragment_impostor.glsl");
     model_shader = Shader("shaders/vertex_model.glsl", "shaders/fragment_model.glsl");
+    gbuffer_shader = Shader("shaders/vertex.glsl", "shaders/fragment_gbuffer.glsl");
+    gbuffer_instanced_shader = Shader("shaders/vertex_instanced.glsl", "shaders/fragment_gbuffer.glsl");
+    gbuffer_animated_shader = Shader("shaders/vertex_animated.glsl", "shaders/fragment_gbuffer.glsl");
+    gbuffer_packed_shader = Shader("shaders/vertex_packed.glsl", "shaders/fragment_gbuffer.glsl");
+    deferred_shader = Shader("shaders/vertex_fullscreen.glsl", "shaders/fragment_deferred.glsl");
+    light_volume_shader = Shader("shaders/vertex_light_volume.glsl", "shaders/fragment_light_volume.glsl");
+
+    // the forward cube programs are built per variant, the first ones at the end of init
+    cube_variants[(int)DrawMode::DIRECT] = CubeVariants("shaders/vertex.glsl", "shaders/fragment.glsl");
+    cube_variants[(int)DrawMode::INSTANCED] = CubeVariants("shaders/vertex_instanced.glsl", "shaders/fragment.glsl");
+    cube_variants[(int)DrawMode::ANIMATED] = CubeVariants("shaders/vertex_animated.glsl", "shaders/fragment.glsl");
+    cube_variants[(int)DrawMode::PACKED] = CubeVariants("shaders/vertex_packed.glsl", "shaders/fragment.glsl");
+
+    Shader *programs[] = {&light_shader, &instanced_light_shader, &animated_light_shader, &impostor_shader,
+                          &packed_impostor_shader, &model_shader, &deferred_shader, &light_volume_shader};
+    // (the cube programs bind it in CubeUniforms::resolve)
+    for(Shader *s : programs){
+        s -> bind_block("Frame", FRAME_BLOCK_BINDING);
+    }
+
+    light_model = light_shader.uniform<glm::mat4>("model");
+    model_uniform = model_shader.uniform<glm::mat4>("model");
+    animated_light_uniforms.resolve(animated_light_shader);
+    impostor_uniforms.resolve(impostor_shader);
+    packed_impostor_uniforms.resolve(packed_impostor_shader);
+
+    gbuffer_uniforms.resolve(gbuffer_shader);
+    gbuffer_instanced_uniforms.resolve(gbuffer_instanced_shader);
+    gbuffer_animated_uniforms.resolve(gbuffer_animated_shader);
+    gbuffer_packed_uniforms.resolve(gbuffer_packed_shader);
+    Shader *lighting[] = {&deferred_shader, &light_volume_shader};
+    for(Shader *s : lighting){
+        s -> use();
+        s -> setInt("gAlbedo", GBUFFER_UNIT + GBUFFER_ALBEDO);
+        s -> setInt("gNormal", GBUFFER_UNIT + GBUFFER_NORMAL);
+        s -> setInt("gDepth", GBUFFER_UNIT + GBUFFER_DEPTH);
+        s -> setInt("lightData", LIGHT_BUFFER_UNIT);
+    }
+    deferred_inv_view_projection = deferred_shader.uniform<glm::mat4>("invViewProjection");
+    volume_inv_view_projection = light_volume_shader.uniform<glm::mat4>("invViewProjection");
+    volume_light_cutoff = light_volume_shader.uniform<float>("lightCutoff");
 }
 
 void Engine::init_textures(){
     int width, height, nrChannels;
-    unsigned char *data = stbi_load("textures/container2.png", &width, &height, &nrChannels, 0); 
+    // always RGBA, as the upload below and the albedo average expect
+    unsigned char *data = stbi_load("textures/container2.png", &width, &height, &nrChannels, 4);
     if(!data){
         std::cout << "Failed to load texture" << std::endl;
         exit(0);
@@ -187,23 +506,42 @@ void Engine::init_textures(){
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
 
+    // the impostors are shaded with the average texel
+    double sum[3] = {0.0, 0.0, 0.0};
+    for(long long p = 0; p < (long long)width * height; p++){
+        for(int ch = 0; ch < 3; ch++){
+            sum[ch] += data[p * 4 + ch];
+        }
+    }
+    double texels = 255.0 * width * height;
+    impostor_albedo = glm::vec3(sum[0] / texels, sum[1] / texels, sum[2] / texels);
+
     stbi_image_free(data);
     
 
     glBindTexture(GL_TEXTURE_2D, texture[1]);
     tracker.countTextureBind();
     data = stbi_load("textures/container2_specular.png", &width, &height, &nrChannels, 0);
+    specular_map = data != NULL;
     if (data)
     {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
         tracker.trackVramAllocation(width * height * 3);
         glGenerateMipmap(GL_TEXTURE_2D);
     }
+
+    // repeat wrap of the cube textures, bound with them
+    glGenSamplers(1, &material_sampler);
+    glSamplerParameteri(material_sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glSamplerParameteri(material_sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glSamplerParameteri(material_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+    glSamplerParameteri(material_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
-void Engine::render_loop(){
+void Engine::render_loop(bool light_benchmark){
     glfwWindowHint(GLFW_DEPTH_BITS, 24);
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_PROGRAM_POINT_SIZE);
 
     projection = glm::perspective(glm::radians(fov), width * 1.f/height, near_plane, far_plane);
 
@@ -217,13 +555,19 @@ void Engine::render_loop(){
         ImGui_ImplOpenGL3_Init("#version 330");
     }
 
-    while(!glfwWindowShouldClose(window))
+    if(light_benchmark){
+        run_light_benchmark();
+    }
+
+    while(!light_benchmark && !glfwWindowShouldClose(window))
     {   
         tracker.beginFrame();
+        glstate.reset_counters();
 
         float t = (float)glfwGetTime();
         dtime = t - past_time;
         past_time = t;
+        frame_time = t;
         process_input();
         cam -> update(right_input, left_input, dtime);
 
@@ -239,6 +583,11 @@ void Engine::render_loop(){
         glfwSwapBuffers(window);
         glfwPollEvents(); 
 
+        pool.collect_times(worker_times);
+        tracker.trackWorkerTimes(worker_times);
+        tracker.trackUniformUpdates(Shader::uniform_updates);
+        Shader::uniform_updates = 0;
+        tracker.trackStateChanges(glstate.issued, glstate.elided);
         tracker.endFrame();
         //tracker.printStats();
     }
@@ -253,116 +602,842 @@ void Engine::render_loop(){
     glDeleteVertexArrays(1, &cVAO);
     glDeleteBuffers(1, &cVBO);
     glDeleteBuffers(1, &cEBO);
+    instance_ring.destroy();
+    glDeleteBuffers(1, &staticVBO);
+    glDeleteQueries(STREAM_FRAMES, overdraw_queries);
+    glDeleteQueries(STREAM_FRAMES, gpu_time_queries);
+    glDeleteVertexArrays(1, &volumeVAO);
+    glDeleteVertexArrays(1, &emptyVAO);
+    glDeleteBuffers(1, &volumeVBO);
+    glDeleteBuffers(1, &volumeEBO);
+    gbuffer.destroy();
+    glDeleteBuffers(1, &frameUBO);
+    glDeleteTextures(1, &light_texture);
+    glDeleteBuffers(1, &lightTBO);
+    glDeleteTextures(2, cluster_textures);
+    glDeleteSamplers(1, &material_sampler);
+    glDeleteBuffers(2, clusterTBO);
     //glDeleteProgram(shaderProgram);
 
+    pool.stop();
+
     glfwTerminate();
 }
 
-void Engine::draw(){
-    tracker.beginCpuRender();
-
-    glm::mat4 view = cam -> viewAtMat();
-
-    /* light_shader.use();
-    tracker.countShaderBind();
-    glBindVertexArray(lightVAO);
-    light_shader.setMatrix("view", view);
-    light_shader.setMatrix("projection", projection);
+void Engine::update_scene_cache(){
+    // the static part of the matrices only changes with spread or the scene itself
+    if(!scene.cache_stale(spread)){
+        return;
+    }
+    pool.parallel_for(0, scene.size(), 4096, CACHE_LINE / sizeof(float), [&](size_t b, size_t e, unsigned){
+        scene.update_cache(b, e, spread);
+    });
+    scene.mark_cached(spread);
+}
 
-    int i;
-    for (i = 0; i < num_lights; i++) {
+void Engine::update_lights(){
+    // The first num_lights cubes orbit around the origin and act as point lights
+    float angle = rot_speed * frame_time;
+    for (int i = 0; i < num_lights; i++) {
         trans[i] = glm::mat4(1.0f);
-        trans[i] = glm::rotate(trans[i], rot_speed * (float)glfwGetTime(), rot[i]);
+        trans[i] = glm::rotate(trans[i], angle, rot[i]);
         trans[i] = glm::scale(trans[i], sc[i]);
         trans[i] = glm::translate(trans[i], spread * tr[i]);
-        trans[i] = glm::rotate(trans[i], rot_speed * (float)glfwGetTime(), rot[i]);
+        trans[i] = glm::rotate(trans[i], angle, rot[i]);
+    }
+}
 
-        light_shader.setMatrix("model", trans[i]);
+bool Engine::needs_normals() const {
+    return cpu_normals || deferred;
+}
 
-        tracker.countDrawCall();
-        tracker.countTriangles(12 * cubes_tot);
-        //glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        
+void Engine::update_transforms(glm::mat4 * out, glm::mat3 * normals_out){
+    // the light positions are read back for the light buffer, so lights live in
+    // trans[] and only get copied when writing somewhere else
+    if(out != trans.data()){
+        std::copy(trans.begin(), trans.begin() + num_lights, out);
     }
 
-    shader.use();
-    tracker.countShaderBind();
-    glBindVertexArray(cVAO);
+    // All the cubes share the same angle, so sin/cos are taken once per frame.
+    // normals_out, if any, gets the cubes' normal matrices, without the lights
+    float angle = rot_speed * frame_time;
+    float c = std::cos(angle), s = std::sin(angle);
+    if(culling){
+        // only the visible cubes, packed right after the lights
+        glm::mat4 * cubes_out = out + num_lights;
+        pool.parallel_for(0, cube_instances, 4096, CACHE_LINE / sizeof(uint32_t), [&](size_t b, size_t e, unsigned){
+            transform_kernel.gather(scene, visible.data() + b, e - b, c, s, cubes_out + b,
+                                    normals_out ? normals_out + b : nullptr);
+        });
+    }
+    else{
+        // chunks start on a cache line of the SoA float arrays
+        glm::mat3 * normals_base = normals_out ? normals_out - num_lights : nullptr;
+        pool.parallel_for(num_lights, cubes_tot, 4096, CACHE_LINE / sizeof(float), [&](size_t b, size_t e, unsigned){
+            transform_kernel.range(scene, b, e, c, s, out, normals_base);
+        });
+    }
+}
 
-    shader.setInt("material.diffuse", 0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture[0]);
-    tracker.countTextureBind();
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+void Engine::update_packed(void * out){
+    std::copy(trans.begin(), trans.begin() + num_lights, (glm::mat4*)out);
+
+    // a quaternion holds half the angle
+    float angle = rot_speed * frame_time;
+    float c = std::cos(angle * .5f), s = std::sin(angle * .5f);
+    PackedInstance * cubes_out = (PackedInstance*)((char*)out + num_lights * sizeof(glm::mat4));
+    if(culling){
+        pool.parallel_for(0, cube_instances, 4096, CACHE_LINE / sizeof(uint32_t), [&](size_t b, size_t e, unsigned){
+            pack_kernel.gather(scene, visible.data() + b, e - b, c, s, cubes_out + b);
+        });
+    }
+    else{
+        // the range kernel writes out[i] for cube i, lights excluded
+        PackedInstance * base = cubes_out - num_lights;
+        pool.parallel_for(num_lights, cubes_tot, 4096, CACHE_LINE / sizeof(float), [&](size_t b, size_t e, unsigned){
+            pack_kernel.range(scene, b, e, c, s, base);
+        });
+    }
+}
 
-    shader.setInt("material.specular", 1);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, texture[1]);
-    tracker.countTextureBind();
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+void Engine::cull_cubes(glm::mat4 &view){
+    if(!culling){
+        cube_instances = std::max(0, cubes_tot - num_lights);
+        return;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+
+    Frustum frustum;
+    frustum.extract(projection * view);
+
+    if(bvh_culling){
+        // rebuilt only when the cube range changes, refitted when spread does
+        // (the scene cache was updated for it just before)
+        if(bvh.begin != (size_t)num_lights || bvh.end != (size_t)cubes_tot){
+            bvh.build(scene, num_lights, cubes_tot);
+        }
+        else if(bvh.spread != spread){
+            bvh.refit(scene, pool);
+        }
+        cube_instances = (int)bvh.cull(frustum, visible.data());
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        tracker.trackCulling(cube_instances, std::max(0, cubes_tot - num_lights) - cube_instances, ms);
+        return;
+    }
+
+    // Every chunk writes its survivors at its own start in visible[], then
+    // the chunks are packed together in index order
+    std::vector<std::pair<size_t, size_t>> chunks;
+    std::mutex chunks_mutex;
+    pool.parallel_for(num_lights, cubes_tot, 4096, CACHE_LINE / sizeof(float), [&](size_t b, size_t e, unsigned){
+        size_t n = cull_kernel.cull(frustum, scene, b, e, visible.data() + b);
+        std::lock_guard<std::mutex> lock(chunks_mutex);
+        chunks.push_back({b, n});
+    });
+    std::sort(chunks.begin(), chunks.end());
+
+    size_t count = 0;
+    for(auto &c : chunks){
+        std::copy(visible.begin() + c.first, visible.begin() + c.first + c.second, visible.begin() + count);
+        count += c.second;
+    }
+    cube_instances = (int)count;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    tracker.trackCulling(cube_instances, std::max(0, cubes_tot - num_lights) - cube_instances, ms);
+}
+
+void Engine::occlusion_cull(glm::mat4 &view){
+    if(!culling || !occlusion_culling){
+        return;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    occlusion.begin(view, projection);
+
+    // the backpack is drawn with an identity model matrix
+    for(const Mesh &mesh : model_obj.getMeshes()){
+        if(mesh.vertices.empty()){
+            continue;
+        }
+        occlusion.add_mesh(&mesh.vertices[0].position.x, sizeof(Vertex), mesh.vertices.size(),
+                           mesh.indices.data(), mesh.indices.size(), glm::mat4(1.f), pool);
+    }
 
+    // Occluder cubes: the visible ones covering the most low resolution
+    // pixels, at least 4 in radius, largest max_occluders of them
+    float min_score = 4.f / (projection[1][1] * OCCLUSION_HEIGHT * .5f);
+    std::vector<std::pair<float, uint32_t>> candidates;
+    std::mutex candidates_mutex;
+    glm::vec3 eye = cam -> position;
+    pool.parallel_for(0, cube_instances, 4096, CACHE_LINE / sizeof(uint32_t), [&](size_t b, size_t e, unsigned){
+        std::vector<std::pair<float, uint32_t>> local;
+        for(size_t k = b; k < e; k++){
+            uint32_t i = visible[k];
+            glm::vec3 s(scene.sx[i], scene.sy[i], scene.sz[i]);
+            glm::vec3 c(scene.px[i], scene.py[i], scene.pz[i]);
+            float score = CUBE_BOUND_RADIUS * std::max(s.x, std::max(s.y, s.z)) / std::max(glm::length(c - eye), near_plane);
+            if(score >= min_score){
+                local.push_back({score, i});
+            }
+        }
+        std::lock_guard<std::mutex> lock(candidates_mutex);
+        candidates.insert(candidates.end(), local.begin(), local.end());
+    });
+    if(candidates.size() > (size_t)max_occluders){
+        std::nth_element(candidates.begin(), candidates.begin() + max_occluders, candidates.end(),
+                         [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b){ return a.first > b.first; });
+        candidates.resize(max_occluders);
+    }
+
+    std::vector<uint32_t> occluders(candidates.size());
+    for(size_t k = 0; k < candidates.size(); k++){
+        occluders[k] = candidates[k].second;
+    }
+    std::vector<glm::mat4> models(occluders.size());
+    float angle = rot_speed * frame_time;
+    transform_kernel.gather(scene, occluders.data(), occluders.size(), std::cos(angle), std::sin(angle), models.data(), nullptr);
+    for(const glm::mat4 &m : models){
+        occlusion.add_cube(m);
+    }
 
-    shader.setMatrix("view", view);
-    shader.setMatrix("projection", projection);
-    shader.setVector3("viewPos", cam -> position);
+    occlusion.rasterize(pool);
+    auto raster_end = std::chrono::high_resolution_clock::now();
+
+    // same in-place chunk compaction as the flat frustum path
+    std::vector<std::pair<size_t, size_t>> chunks;
+    std::mutex chunks_mutex;
+    pool.parallel_for(0, cube_instances, 4096, CACHE_LINE / sizeof(uint32_t), [&](size_t b, size_t e, unsigned){
+        size_t n = b;
+        for(size_t k = b; k < e; k++){
+            uint32_t i = visible[k];
+            glm::vec3 s(scene.sx[i], scene.sy[i], scene.sz[i]);
+            glm::vec3 c(scene.px[i], scene.py[i], scene.pz[i]);
+            if(occlusion.sphere_visible(c, CUBE_BOUND_RADIUS * std::max(s.x, std::max(s.y, s.z)))){
+                visible[n++] = i;
+            }
+        }
+        std::lock_guard<std::mutex> lock(chunks_mutex);
+        chunks.push_back({b, n - b});
+    });
+    std::sort(chunks.begin(), chunks.end());
+
+    size_t count = 0;
+    for(auto &c : chunks){
+        std::copy(visible.begin() + c.first, visible.begin() + c.first + c.second, visible.begin() + count);
+        count += c.second;
+    }
+    int occluded = cube_instances - (int)count;
+    cube_instances = (int)count;
 
+    auto end = std::chrono::high_resolution_clock::now();
+    tracker.trackOcclusion(occluded, (int)occlusion.triangles(),
+                           std::chrono::duration<double, std::milli>(raster_end - start).count(),
+                           std::chrono::duration<double, std::milli>(end - raster_end).count());
+}
+
+void Engine::select_lods(){
+    lod_counts[0] = cube_instances;
+    lod_counts[1] = 0;
+    if((draw_mode != DrawMode::INSTANCED && draw_mode != DrawMode::PACKED) || !culling || lod_pixels <= 0.f){
+        tracker.trackLods(lod_counts[0], lod_counts[1]);
+        return;
+    }
+
+    // projected diameter in pixels is 2r * height/2 * projection[1][1] / distance
+    float px_per_unit = CUBE_BOUND_RADIUS * height * projection[1][1] / lod_pixels;
+    glm::vec3 eye = cam -> position;
+
+    // every chunk puts its full cubes first, then both parts of all the
+    // chunks are packed into lod_scratch, which becomes visible[]
+    struct Part {
+        size_t begin, full, count;
+        bool operator<(const Part &o) const { return begin < o.begin; }
+    };
+    std::vector<Part> parts;
+    std::mutex parts_mutex;
+    pool.parallel_for(0, cube_instances, 4096, CACHE_LINE / sizeof(uint32_t), [&](size_t b, size_t e, unsigned){
+        uint32_t *mid = std::partition(visible.data() + b, visible.data() + e, [&](uint32_t i){
+            glm::vec3 s(scene.sx[i], scene.sy[i], scene.sz[i]);
+            glm::vec3 c(scene.px[i], scene.py[i], scene.pz[i]);
+            return std::max(s.x, std::max(s.y, s.z)) * px_per_unit >= glm::length(c - eye);
+        });
+        std::lock_guard<std::mutex> lock(parts_mutex);
+        parts.push_back({b, (size_t)(mid - (visible.data() + b)), e - b});
+    });
+    std::sort(parts.begin(), parts.end());
+
+    size_t full = 0;
+    for(auto &p : parts){
+        full += p.full;
+    }
+    size_t near_out = 0, far_out = full;
+    for(auto &p : parts){
+        std::copy(visible.begin() + p.begin, visible.begin() + p.begin + p.full, lod_scratch.begin() + near_out);
+        std::copy(visible.begin() + p.begin + p.full, visible.begin() + p.begin + p.count, lod_scratch.begin() + far_out);
+        near_out += p.full;
+        far_out += p.count - p.full;
+    }
+    visible.swap(lod_scratch);
+
+    lod_counts[0] = (int)full;
+    lod_counts[1] = cube_instances - (int)full;
+    tracker.trackLods(lod_counts[0], lod_counts[1]);
+}
+
+void Engine::sort_visible(glm::mat4 &view){
+    if(!culling || sort_order == SortOrder::NONE){
+        return;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // View depth quantized to 16 bits between the planes: plenty to order
+    // overdraw, and the two upper radix passes are skipped as trivial
+    glm::vec4 depth_row(view[0][2], view[1][2], view[2][2], view[3][2]);
+    float to_key = 65535.f / (far_plane - near_plane);
+    bool reverse = sort_order == SortOrder::BACK_TO_FRONT;
+
+    // each LOD group is sorted on its own so the groups stay contiguous
+    int first = 0;
+    for(int lod = 0; lod < LOD_LEVELS; lod++){
+        size_t n = lod_counts[lod];
+        uint32_t *vis = visible.data() + first;
+        uint32_t *keys = sort_keys.data() + first;
+        pool.parallel_for(0, n, 4096, CACHE_LINE / sizeof(uint32_t), [&](size_t b, size_t e, unsigned){
+            for(size_t k = b; k < e; k++){
+                uint32_t i = vis[k];
+                float depth = -glm::dot(depth_row, glm::vec4(scene.px[i], scene.py[i], scene.pz[i], 1.f));
+                uint32_t key = (uint32_t)std::min(65535.f, std::max(0.f, (depth - near_plane) * to_key));
+                keys[k] = reverse ? 65535u - key : key;
+            }
+        });
+        radix_sort_pairs(keys, vis, n, sort_keys_tmp.data(), lod_scratch.data(), sort_hist, pool);
+        first += lod_counts[lod];
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    tracker.trackSort(ms);
+}
+
+void Engine::begin_overdraw_query(){
+    // the query issued STREAM_FRAMES frames ago is read only once it is ready, never waited on
+    int q = overdraw_frame % STREAM_FRAMES;
+    if(overdraw_pending[q]){
+        GLint ready = 0;
+        glGetQueryObjectiv(overdraw_queries[q], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if(ready){
+            GLuint samples = 0;
+            glGetQueryObjectuiv(overdraw_queries[q], GL_QUERY_RESULT, &samples);
+            overdraw = samples / std::max(1.0, (double)width * height);
+        }
+        else{
+            // still in flight: skip this frame's measurement rather than reuse the object
+            return;
+        }
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, overdraw_queries[q]);
+    overdraw_pending[q] = true;
+}
+
+void Engine::end_overdraw_query(){
+    int q = overdraw_frame % STREAM_FRAMES;
+    overdraw_frame++;
+    GLint active = 0;
+    glGetQueryiv(GL_SAMPLES_PASSED, GL_CURRENT_QUERY, &active);
+    if((GLuint)active == overdraw_queries[q]){
+        glEndQuery(GL_SAMPLES_PASSED);
+    }
+    tracker.trackOverdraw(overdraw);
+}
+
+void Engine::begin_gpu_timer(){
+    // same scheme as the overdraw queries
+    int q = gpu_time_frame % STREAM_FRAMES;
+    if(gpu_time_pending[q]){
+        GLint ready = 0;
+        glGetQueryObjectiv(gpu_time_queries[q], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if(ready){
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(gpu_time_queries[q], GL_QUERY_RESULT, &ns);
+            gpu_time = ns / 1e6;
+            if(gpu_time_variants[q]){
+                gpu_time_variants[q] -> time_frame(gpu_time);
+            }
+        }
+        else{
+            return;
+        }
+    }
+    glBeginQuery(GL_TIME_ELAPSED, gpu_time_queries[q]);
+    gpu_time_pending[q] = true;
+}
+
+void Engine::end_gpu_timer(){
+    int q = gpu_time_frame % STREAM_FRAMES;
+    gpu_time_frame++;
+    GLint active = 0;
+    glGetQueryiv(GL_TIME_ELAPSED, GL_CURRENT_QUERY, &active);
+    if((GLuint)active == gpu_time_queries[q]){
+        glEndQuery(GL_TIME_ELAPSED);
+        // the frame's time goes to the forward variant it was drawn with, if any
+        gpu_time_variants[q] = frame_variant;
+    }
+    tracker.trackGpuTime(gpu_time, deferred);
+}
+
+void Engine::fit_gbuffer(){
+    // the G-buffer only exists while the deferred path is on, at the framebuffer size
+    int w = 0, h = 0;
+    if(deferred){
+        glfwGetFramebufferSize(window, &w, &h);
+    }
+    if(w == gbuffer.width() && h == gbuffer.height()){
+        return;
+    }
+    tracker.trackVramDeallocation(gbuffer.bytes());
+    if(w > 0 && h > 0){
+        gbuffer.init(w, h);
+        tracker.trackVramAllocation(gbuffer.bytes());
+    }
+    else{
+        gbuffer.destroy();
+    }
+}
+
+void Engine::draw_deferred_lighting(glm::mat4 &view){
+    // Lighting passes into the default framebuffer, every pixel read back
+    // from the G-buffer; no depth test, the G-buffer depth is the scene's
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_DEPTH_TEST);
+    gbuffer.bind_textures(GBUFFER_UNIT);
+    glm::mat4 inv_view_projection = glm::inverse(projection * view);
+
+    // directional light, and the unlit pixels copied over: one full screen triangle
+    tracker.countShaderBind(deferred_shader.use());
+    deferred_shader.set(deferred_inv_view_projection, inv_view_projection);
+    glstate.bind_vertex_array(emptyVAO);
+    tracker.countDrawCall();
+    tracker.countTriangles(1);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // point lights added over the back faces of the box around each radius,
+    // so the volume is still drawn with the camera inside it
+    if(num_lights > 0){
+        tracker.countShaderBind(light_volume_shader.use());
+        light_volume_shader.set(volume_inv_view_projection, inv_view_projection);
+        light_volume_shader.set(volume_light_cutoff, light_cutoff);
+        tracker.countTextureBind(glstate.bind_texture(LIGHT_BUFFER_UNIT, GL_TEXTURE_BUFFER, light_texture));
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        // a box reaching past the far plane would lose the back faces that
+        // cover the pixels in front of it: clamp their depth instead of clipping
+        glEnable(GL_DEPTH_CLAMP);
+        glstate.bind_vertex_array(volumeVAO);
+        tracker.countDrawCall();
+        tracker.countTriangles(12 * num_lights);
+        glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, num_lights);
+        glDisable(GL_DEPTH_CLAMP);
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+    }
+    glEnable(GL_DEPTH_TEST);
+}
+
+void Engine::AnimationUniforms::resolve(Shader &s){
+    time = s.uniform<float>("time");
+    spread = s.uniform<float>("spread");
+    rot_speed = s.uniform<float>("rotSpeed");
+    orbit = s.uniform<bool>("orbit");
+}
+
+void Engine::ImpostorUniforms::resolve(Shader &s){
+    pixel_scale = s.uniform<float>("pixelScale");
+    albedo = s.uniform<glm::vec3>("albedo");
+}
+
+void Engine::CubeUniforms::resolve(Shader &s){
+    // variants are built after init_shaders, so each binds its own block
+    s.bind_block("Frame", FRAME_BLOCK_BINDING);
+    model = s.uniform<glm::mat4>("model");
+    normal_matrix = s.uniform<glm::mat3>("normalMatrix");
+    num_lights = s.uniform<int>("numLights");
+    light_cutoff = s.uniform<float>("lightCutoff");
+    clustered = s.uniform<bool>("clustered");
+    cluster_scale = s.uniform<glm::vec4>("clusterScale");
+    animation.resolve(s);
+
+    // never change, so they are set once here
+    s.use();
+    s.setInt("material.diffuse", 0);
+    s.setInt("material.specular", 1);
+    s.setInt("lightData", LIGHT_BUFFER_UNIT);
+    s.setInt("clusterGrid", CLUSTER_GRID_UNIT);
+    s.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+    s.set(s.uniform<glm::ivec3>("clusterDims"), glm::ivec3(CLUSTER_X, CLUSTER_Y, CLUSTER_Z));
+    s.setFloat("material.shininess", 32.0f);
     glm::vec3 objColor(1.f, .5f, .31f);
-    glm::vec3 lightColor(1.f, 1.f, 1.f);
-    shader.setVector3("objectColor", objColor);
+    s.setVector3("objectColor", objColor);
+}
+
+void Engine::update_frame_block(glm::mat4 &view){
+    FrameBlock frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.view_pos = glm::vec4(cam -> position, 1.f);
+    frame.light_direction = glm::vec4(-1.f, -1.f, 0.f, 0.f);
+    frame.light_ambient = glm::vec4(.2f, .2f, .2f, 0.f);
+    frame.light_diffuse = glm::vec4(.5f, .5f, .5f, 0.f);
+    frame.light_specular = glm::vec4(1.f, 1.f, 1.f, 0.f);
+
+    glstate.bind_buffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &frame);
+    tracker.trackDataUpload(sizeof(FrameBlock));
+}
+
+void Engine::upload_light_texture(unsigned int buffer, const void *data, long long bytes, long long &allocated){
+    // The store only grows, doubling, so a frame writes into it in place
+    // instead of allocating a new one. GL 3.3 has no glTexBufferRange to
+    // point the texture at a slice of a ring
+    glstate.bind_buffer(GL_TEXTURE_BUFFER, buffer);
+    if(bytes > allocated){
+        long long capacity = std::max(bytes, 2 * allocated);
+        glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+        tracker.trackVramDeallocation(allocated);
+        tracker.trackVramAllocation(capacity);
+        allocated = capacity;
+    }
+    if(bytes > 0){
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+        tracker.trackDataUpload(bytes);
+    }
+}
 
-    shader.setInt("numLights", num_lights);
-    shader.setFloat("material.shininess", 32.0f);
+void Engine::update_light_buffer(glm::mat4 &view){
+    // The light cubes' positions, computed by update_lights, plus their colors
+    float radius = light_radius(light_cutoff);
+    light_data.resize(num_lights);
+    for (int i = 0; i < num_lights; i++) {
+        light_data[i].position = trans[i] * glm::vec4(0.f, 0.f, 0.f, 1.f);
+        light_data[i].position.w = radius;
+        light_data[i].ambient = glm::vec4(.2f, .2f, .2f, 0.f);
+        light_data[i].diffuse = glm::vec4(.5f, .5f, .5f, 0.f);
+        light_data[i].specular = glm::vec4(1.f, 1.f, 1.f, 0.f);
+    }
+    upload_light_texture(lightTBO, light_data.data(), (long long)num_lights * sizeof(PointLight), light_bytes);
 
-    glm::vec3 ambientLight(.2f, .2f, .2f);
-    glm::vec3 diffuseLight(.5f, .5f, .5f);
-    glm::vec3 specularLight(1.f, 1.f, 1.f);
-    
-    glm::vec3 direction(-1.f, -1.f, 0.f);
+    // the deferred path bounds every light by its volume instead, and a
+    // variant with the light count baked in loops over all of them
+    if(!uses_clusters()){
+        tracker.trackLightClusters(num_lights, 0, 0.0);
+        return;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    clusters.build(light_data.data(), num_lights, view, projection, near_plane, far_plane, pool);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    tracker.trackLightClusters(num_lights, (long long)clusters.assignments(), ms);
 
-    shader.setVector3("directionalLight.direction", direction);
-    shader.setVector3("directionalLight.ambient", ambientLight);
-    shader.setVector3("directionalLight.diffuse", diffuseLight);
-    shader.setVector3("directionalLight.specular", specularLight);
+    upload_light_texture(clusterTBO[0], clusters.grid.data(), (long long)clusters.grid.size() * sizeof(uint32_t), cluster_bytes[0]);
+    upload_light_texture(clusterTBO[1], clusters.indices.data(), (long long)clusters.indices.size() * sizeof(uint32_t), cluster_bytes[1]);
+}
+
+ShaderDefines Engine::cube_defines() const {
+    ShaderDefines d;
+    if(specialize_shaders && num_lights <= MAX_UNROLLED_LIGHTS){
+        d.lights = num_lights;
+    }
+    d.specular_map = specular_map;
+    d.lighting_model = lighting_model;
+    d.cpu_normals = cpu_normals;
+    return d;
+}
+
+Engine::CubeVariants::Variant &Engine::cube_variant(){
+    CubeVariants::Variant &v = cube_variants[(int)draw_mode].get(cube_defines());
+    frame_variant = &v;
+    return v;
+}
+
+bool Engine::uses_clusters() const {
+    return clustered_lights && !deferred && cube_defines().lights == DYNAMIC_LIGHTS;
+}
+
+void Engine::set_cube_uniforms(Shader &s, CubeUniforms &u){
+    // the textures come with the cube material, see add_cube_material
+    s.set(u.num_lights, num_lights);
+    s.set(u.light_cutoff, light_cutoff);
+    s.set(u.clustered, clustered_lights);
+    // fragment.glsl: tile = gl_FragCoord.xy * xy, slice = log(view depth) * z + w
+    int fb_width, fb_height;
+    glfwGetFramebufferSize(window, &fb_width, &fb_height);
+    s.set(u.cluster_scale, glm::vec4((float)CLUSTER_X / std::max(1, fb_width), (float)CLUSTER_Y / std::max(1, fb_height),
+                                     clusters.slice_scale, clusters.slice_bias));
+}
+
+void Engine::set_animation_uniforms(Shader &s, AnimationUniforms &u, bool orbit){
+    s.set(u.time, frame_time);
+    s.set(u.spread, spread);
+    s.set(u.rot_speed, rot_speed);
+    s.set(u.orbit, orbit);
+}
+
+uint16_t Engine::add_cube_material(){
+    // the wrap mode lives in material_sampler, set once
+    RenderMaterial m;
+    for(int t = 0; t < 2; t++){
+        m.add_texture(t, GL_TEXTURE_2D, texture[t], material_sampler);
+    }
+    m.add_texture(LIGHT_BUFFER_UNIT, GL_TEXTURE_BUFFER, light_texture);
+    if(uses_clusters()){
+        for(int t = 0; t < 2; t++){
+            m.add_texture(CLUSTER_GRID_UNIT + t, GL_TEXTURE_BUFFER, cluster_textures[t]);
+        }
+    }
+    return queue.add_material(m);
+}
+
+uint16_t Engine::add_cube_program(Shader &s, CubeUniforms &u){
+    RenderProgram program;
+    program.shader = &s;
+    program.model = u.model;
+    if(needs_normals()){
+        program.normal_matrix = u.normal_matrix;
+    }
+    program.setup = [this, &u](Shader &shader){ set_cube_uniforms(shader, u); };
+    return queue.add_program(program);
+}
+
+float Engine::queue_depth(const glm::vec4 &depth_row, const glm::vec3 &position) const {
+    // view depth between the planes, flipped for SortOrder::BACK_TO_FRONT;
+    // without a sort every packet gets the same depth and keeps its submission order
+    if(sort_order == SortOrder::NONE){
+        return 0.f;
+    }
+    float depth = (-glm::dot(depth_row, glm::vec4(position, 1.f)) - near_plane) / (far_plane - near_plane);
+    return sort_order == SortOrder::BACK_TO_FRONT ? 1.f - depth : depth;
+}
 
+void Engine::submit_cubes_direct(glm::mat4 &view){
+    queue.set_transforms(trans.data(), normals.data());
+    glm::vec4 depth_row(view[0][2], view[1][2], view[2][2], view[3][2]);
 
+    RenderProgram lights;
+    lights.shader = &light_shader;
+    lights.model = light_model;
+    RenderPacket packet = {lightVAO, 36, 0, 0, queue.add_program(lights), 0, GL_TRIANGLES};
+    int i;
     for (i = 0; i < num_lights; i++) {
-        glm::vec3 position = trans[i] * glm::vec4(0.f, 0.f, 0.f, 1.f);
-        shader.setVector3("lights[" + std::to_string(i) + "].position", position);
-        shader.setVector3("lights[" + std::to_string(i) + "].ambient", ambientLight);
-        shader.setVector3("lights[" + std::to_string(i) + "].diffuse", diffuseLight);
-        shader.setVector3("lights[" + std::to_string(i) + "].specular", specularLight);
+        packet.transform = i;
+        queue.submit(RenderPass::OPAQUE, packet, queue_depth(depth_row, glm::vec3(trans[i][3])));
     }
 
-    for (;i < cubes_tot; i++) {
-        trans[i] = glm::mat4(1.0f);
-        trans[i] = glm::scale(trans[i], sc[i]);
-        trans[i] = glm::translate(trans[i], spread * tr[i]);
-        trans[i] = glm::rotate(trans[i], rot_speed * (float)glfwGetTime(), rot[i]);
+    CubeVariants::Variant *forward = deferred ? nullptr : &cube_variant();
+    packet.vao = cVAO;
+    packet.program = deferred ? add_cube_program(gbuffer_shader, gbuffer_uniforms)
+                              : add_cube_program(forward -> shader, forward -> handles);
+    packet.material = add_cube_material();
+    for (;i < num_lights + cube_instances; i++) {
+        packet.transform = i;
+        queue.submit(RenderPass::OPAQUE, packet, queue_depth(depth_row, glm::vec3(trans[i][3])));
+    }
+}
 
-        shader.setMatrix("model", trans[i]);
+void Engine::set_impostor_uniforms(Shader &s, ImpostorUniforms &u){
+    s.set(u.pixel_scale, height * .5f * projection[1][1]);
+    s.set(u.albedo, impostor_albedo);
+}
 
-        tracker.countDrawCall();
-        tracker.countTriangles(12 * cubes_tot);
-        //glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-    } */
+void Engine::submit_cubes_instanced(){
+    // The instances go straight into this frame's region of the ring,
+    // lights as full matrices, cubes as matrices or packed
+    bool packed = draw_mode == DrawMode::PACKED;
+    size_t instance_size = packed ? sizeof(PackedInstance) : sizeof(glm::mat4);
+    size_t cubes_offset = num_lights * sizeof(glm::mat4);
+    size_t bytes = cubes_offset + (size_t)cube_instances * instance_size;
+    // then the cubes' normal matrices, unless the vertex shader inverts the model
+    bool normals_in_ring = !packed && needs_normals();
+    size_t normals_offset = bytes;
+    if(normals_in_ring){
+        bytes += (size_t)cube_instances * sizeof(glm::mat3);
+    }
+    void * out = instance_ring.map(bytes);
+    if(packed){
+        update_packed(out);
+    }
+    else{
+        update_transforms((glm::mat4*)out, normals_in_ring ? (glm::mat3*)((char*)out + normals_offset) : nullptr);
+    }
+    instance_ring.unmap();
+    tracker.trackInstanceSize(instance_size);
+    tracker.trackDataUpload(bytes);
+    tracker.trackFenceWait(instance_ring.wait_ms);
+    if((long long)instance_ring.capacity() != instance_bytes){
+        tracker.trackVramDeallocation(instance_bytes);
+        tracker.trackVramAllocation(instance_ring.capacity());
+        instance_bytes = instance_ring.capacity();
+    }
 
-    // qua dico usa sto shader ora
-    model_shader.use();
-    model_shader.setMatrix("projection", projection);
-    model_shader.setMatrix("view", view);
+    // the VAOs point into this frame's region from here until the queue runs,
+    // the ring is fenced once it has
+    RenderProgram lights;
+    lights.shader = &instanced_light_shader;
+    set_instance_attribs(lightVAO, instance_ring.offset());
+    if(num_lights > 0){
+        RenderPacket packet = {lightVAO, 36, (uint32_t)num_lights, RENDER_NO_TRANSFORM, queue.add_program(lights), 0, GL_TRIANGLES};
+        queue.submit(RenderPass::OPAQUE, packet);
+    }
 
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
-    model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
-    model_shader.setMatrix("model", model);
+    CubeVariants::Variant *forward = deferred ? nullptr : &cube_variant();
+    // the cube instances start right after the lights in the region
+    if(packed){
+        set_packed_attribs(cVAO, instance_ring.offset() + cubes_offset);
+    }
+    else{
+        set_instance_attribs(cVAO, instance_ring.offset() + cubes_offset);
+        if(normals_in_ring){
+            set_normal_attribs(cVAO, instance_ring.offset() + normals_offset);
+        }
+        else{
+            for(int c = 0; c < 3; c++){
+                glDisableVertexAttribArray(7 + c);
+            }
+        }
+    }
+    if(lod_counts[0] > 0){
+        uint16_t program;
+        if(deferred){
+            program = packed ? add_cube_program(gbuffer_packed_shader, gbuffer_packed_uniforms)
+                             : add_cube_program(gbuffer_instanced_shader, gbuffer_instanced_uniforms);
+        }
+        else{
+            program = add_cube_program(forward -> shader, forward -> handles);
+        }
+        RenderPacket packet = {cVAO, 36, (uint32_t)lod_counts[0], RENDER_NO_TRANSFORM, program, add_cube_material(), GL_TRIANGLES};
+        queue.submit(RenderPass::OPAQUE, packet);
+    }
 
-    model_obj.Draw(model_shader);
+    // the impostors come right after the full cubes, one point each
+    if(lod_counts[1] > 0){
+        RenderProgram sprites;
+        sprites.shader = packed ? &packed_impostor_shader : &impostor_shader;
+        ImpostorUniforms &sprite_uniforms = packed ? packed_impostor_uniforms : impostor_uniforms;
+        sprites.setup = [this, &sprite_uniforms](Shader &shader){ set_impostor_uniforms(shader, sprite_uniforms); };
+        size_t sprites_offset = instance_ring.offset() + cubes_offset + lod_counts[0] * instance_size;
+        if(packed){
+            set_packed_attribs(impostorVAO, sprites_offset);
+        }
+        else{
+            set_instance_attribs(impostorVAO, sprites_offset);
+        }
+        RenderPacket packet = {impostorVAO, 1, (uint32_t)lod_counts[1], RENDER_NO_TRANSFORM, queue.add_program(sprites), 0, GL_POINTS};
+        queue.submit(RenderPass::OPAQUE, packet);
+    }
+}
 
+void Engine::submit_cubes_animated(){
+    // Only the light positions are computed on the CPU (in draw), for the light buffer
+    if(cubes_tot > static_count){
+        upload_static_instances();
+    }
 
+    RenderProgram lights;
+    lights.shader = &animated_light_shader;
+    lights.setup = [this](Shader &shader){ set_animation_uniforms(shader, animated_light_uniforms, true); };
+    set_static_attribs(lightVAO, 0);
+    if(num_lights > 0){
+        RenderPacket packet = {lightVAO, 36, (uint32_t)num_lights, RENDER_NO_TRANSFORM, queue.add_program(lights), 0, GL_TRIANGLES};
+        queue.submit(RenderPass::OPAQUE, packet);
+    }
 
+    CubeVariants::Variant *forward = deferred ? nullptr : &cube_variant();
+    CubeUniforms &cube_uniforms = deferred ? gbuffer_animated_uniforms : forward -> handles;
+    RenderProgram cubes;
+    cubes.shader = deferred ? &gbuffer_animated_shader : &forward -> shader;
+    cubes.setup = [this, &cube_uniforms](Shader &shader){
+        set_animation_uniforms(shader, cube_uniforms.animation, false);
+        set_cube_uniforms(shader, cube_uniforms);
+    };
+    set_static_attribs(cVAO, num_lights * 9 * sizeof(float));
+    if(cubes_tot > num_lights){
+        RenderPacket packet = {cVAO, 36, (uint32_t)(cubes_tot - num_lights), RENDER_NO_TRANSFORM, queue.add_program(cubes),
+                               add_cube_material(), GL_TRIANGLES};
+        queue.submit(RenderPass::OPAQUE, packet);
+    }
+}
 
-    glBindVertexArray(0);
+void Engine::submit_model(glm::mat4 &view){
+    RenderProgram program;
+    program.shader = &model_shader;
+    program.setup = [this](Shader &shader){ shader.set(model_uniform, model_transform); };
+    glm::vec4 depth_row(view[0][2], view[1][2], view[2][2], view[3][2]);
+    model_obj.submit(queue, queue.add_program(program), queue_depth(depth_row, glm::vec3(0.f)));
+}
 
+void Engine::draw(){
+    tracker.beginCpuRender();
+    begin_gpu_timer();
+    frame_variant = nullptr;
+
+    glm::mat4 view = cam -> viewAtMat();
+
+    // the lights move first: every mode reads their positions from trans[]
+    update_lights();
+    update_frame_block(view);
+    update_light_buffer(view);
+
+    // deferred: everything up to the lighting passes goes to the G-buffer
+    fit_gbuffer();
+    if(deferred){
+        const float background[4] = {0.2f, 0.3f, 0.3f, 1.0f};
+        gbuffer.begin(background);
+    }
+
+    // every draw of the geometry pass goes through the queue, sorted by state
+    queue.reset();
+    if(draw_mode == DrawMode::INSTANCED || draw_mode == DrawMode::PACKED){
+        update_scene_cache();
+        cull_cubes(view);
+        occlusion_cull(view);
+        select_lods();
+        sort_visible(view);
+        submit_cubes_instanced();
+    }
+    else if(draw_mode == DrawMode::ANIMATED){
+        submit_cubes_animated();
+    }
+    else{
+        update_scene_cache();
+        cull_cubes(view);
+        occlusion_cull(view);
+        select_lods();
+        sort_visible(view);
+        // the normal matrices sit at the same index as their cube in trans[]
+        update_transforms(trans.data(), needs_normals() ? normals.data() + num_lights : nullptr);
+        submit_cubes_direct(view);
+    }
+    submit_model(view);
+
+    begin_overdraw_query();
+    queue.execute(pool, tracker);
+    end_overdraw_query();
+    if(draw_mode == DrawMode::INSTANCED || draw_mode == DrawMode::PACKED){
+        instance_ring.fence();
+    }
+
+    if(deferred){
+        draw_deferred_lighting(view);
+    }
+
+    end_gpu_timer();
+    if(frame_variant){
+        tracker.trackShaderVariant(frame_variant -> defines.key(), frame_variant -> build_ms);
+    }
+    else{
+        tracker.trackShaderVariant(-1, 0.0);
+    }
     tracker.endCpuRender();
 
 }
@@ -378,11 +1453,53 @@ void Engine::draw_imgui(){
     
     ImGui::Begin("CUBES");
     ImGui::InputInt("Num Cubes", &cubes_tot);
-    cubes_tot = std::min(CUBES, cubes_tot);
+    cubes_tot = std::max(0, std::min(CUBES, cubes_tot));
     ImGui::InputInt("Num Lights", &num_lights);
-    num_lights = std::min(num_lights, cubes_tot);
+    num_lights = std::max(0, std::min(num_lights, cubes_tot));
+    fit_scene_storage();
     ImGui::InputFloat("Spread fact", &spread);
     ImGui::InputFloat("Rot Speed", &rot_speed);
+    ImGui::Checkbox("Frustum culling", &culling);
+    ImGui::Checkbox("BVH culling", &bvh_culling);
+    ImGui::Checkbox("Occlusion culling", &occlusion_culling);
+    ImGui::SliderInt("Occluder cubes", &max_occluders, 0, 256);
+    ImGui::Checkbox("Deferred shading", &deferred);
+    ImGui::Text("GPU: %.3f ms, G-buffer %.1f MB", gpu_time, gbuffer.bytes() / (1024.0 * 1024.0));
+    ImGui::Checkbox("Clustered lights", &clustered_lights);
+    ImGui::SliderFloat("Light cutoff", &light_cutoff, .005f, .5f, "%.3f");
+    ImGui::Text("Light radius %.1f, %lld binned in %.3f ms", light_radius(light_cutoff),
+                tracker.lightAssignments, tracker.lightCullTime);
+    ImGui::Text("Visible: %d / %d", cube_instances, std::max(0, cubes_tot - num_lights));
+    ImGui::Text("Scene memory: %.1f MB (peak %.1f MB)", tracker.sceneMemory / (1024.0 * 1024.0), tracker.peakSceneMemory / (1024.0 * 1024.0));
+    const char *orders[] = {"None", "Front to back", "Back to front"};
+    int order = (int)sort_order;
+    ImGui::Combo("Depth sort", &order, orders, 3);
+    sort_order = (SortOrder)order;
+    ImGui::Text("Overdraw: %.2f samples/pixel", overdraw);
+    ImGui::Text("Uniform updates: %lld/frame", tracker.uniformUpdates);
+    ImGui::Text("State changes: %lld issued, %lld elided", tracker.stateChanges, tracker.stateElided);
+    // the variants only specialize the forward programs: the G-buffer ones
+    // always read the specular map and CPU normals, the lighting passes are Phong
+    ImGui::BeginDisabled(deferred);
+    ImGui::Checkbox("Specialized shaders", &specialize_shaders);
+    const char *models[] = {"Lambert", "Phong", "Blinn-Phong"};
+    ImGui::Combo("Lighting model", &lighting_model, models, 3);
+    ImGui::Checkbox("CPU normal matrix", &cpu_normals);
+    ImGui::EndDisabled();
+    if(deferred){
+        ImGui::TextDisabled("Deferred: Phong, specular map and CPU normals");
+    }
+    for(const auto &entry : cube_variants[(int)draw_mode].all()){
+        const CubeVariants::Variant &v = entry.second;
+        ImGui::Text("%s%s: build %.2f ms, GPU %.3f ms (%lld frames)", &v == frame_variant ? "> " : "  ",
+                    v.defines.name().c_str(), v.build_ms, v.average_gpu_ms(), v.frames);
+    }
+    ImGui::InputFloat("Impostor below (px)", &lod_pixels);
+    ImGui::Text("LOD0 mesh: %d  LOD1 impostor: %d", lod_counts[0], lod_counts[1]);
+    if(draw_mode == DrawMode::INSTANCED || draw_mode == DrawMode::PACKED){
+        ImGui::Text("Instances: %d B each, %.1f KB/frame, ring %.1f MB", (int)tracker.instanceSize,
+                    tracker.dataUploadedThisFrame / 1024.0, instance_ring.capacity() / (1024.0 * 1024.0));
+    }
     ImGui::End();
 
     ImGui::Begin("CAMERA");
@@ -406,28 +1523,57 @@ void Engine::draw_imgui(){
         fov = f;
         projection = glm::perspective(glm::radians(fov), width * 1.f/height, near_plane, far_plane);
     }
-
+    ImGui::Text("LOD0 mesh: %d  LOD1 impostor: %d", lod_counts[0], lod_counts[1]);
 
     ImGui::End();
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    // it restores what it binds, but without going through the cache
+    glstate.invalidate();
 }
 
 
 int main(int argc, char * argv[]){
     if(argc < 4){
         std::cerr << "Not enough parameter passed. You must give, in order, num of cubes, whether to draw imgui and whether to save stats" << std::endl;
+        std::cerr << "Optionally a fourth parameter selects the draw mode: direct (default), instanced, animated or packed" << std::endl;
+        std::cerr << "then a fifth one the seed of the cube field (default 1) and a sixth one, lightbench, runs the light count benchmark" << std::endl;
         return -1;
     }
 
+    DrawMode mode = DrawMode::DIRECT;
+    if(argc > 4){
+        if(strcmp(argv[4], "instanced") == 0){
+            mode = DrawMode::INSTANCED;
+        }
+        else if(strcmp(argv[4], "animated") == 0){
+            mode = DrawMode::ANIMATED;
+        }
+        else if(strcmp(argv[4], "packed") == 0){
+            mode = DrawMode::PACKED;
+        }
+        else if(strcmp(argv[4], "direct") != 0){
+            std::cerr << "Unknown draw mode: " << argv[4] << std::endl;
+            return -1;
+        }
+    }
+
+    uint64_t seed = 1;
+    if(argc > 5){
+        seed = std::strtoull(argv[5], nullptr, 10);
+    }
+
+    // "lightbench" after the seed runs the light count sweep and exits
+    bool light_benchmark = argc > 6 && strcmp(argv[6], "lightbench") == 0;
+
     Engine engine;
     int c = std::atoi(argv[1]);
-    if(engine.init(c, strcmp(argv[2], "true") == 0, strcmp(argv[3], "true") == 0)){
+    if(engine.init(c, strcmp(argv[2], "true") == 0, strcmp(argv[3], "true") == 0, mode, seed)){
         return -1;
     }
 
-    engine.render_loop();
+    engine.render_loop(light_benchmark);
 
     return 0;
 }
@@ -7,25 +7,85 @@
 
 #include "perfTracker.h"
 #include "model.h"
+#include "cubeTransforms.h"
+#include "instancePacking.h"
+#include "threadPool.h"
+#include "frustum.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "radixSort.h"
+#include "streamBuffer.h"
+#include "glExtensions.h"
+#include "counterRng.h"
+#include "lightClusters.h"
+#include "gBuffer.h"
+#include "shaderVariants.h"
+#include "renderQueue.h"
 
 #define WIN_WIDTH 800
 #define WIN_HEIGHT 600
 
 #define NUM 2
-#define CUBES 1000000
+#define CUBES 1000000         // upper bound of the cube field
+#define SCENE_CHUNK 65536       // the scene storage grows by whole chunks of cubes
+
+// How the cube field is submitted to the GPU
+enum class DrawMode {
+    DIRECT,     // one glDrawElements (and one "model" uniform) per cube
+    INSTANCED,  // all model matrices in one instance buffer, one draw per VAO
+    ANIMATED,   // static tr/sc/rot instance attributes, matrices built in the vertex shader
+    PACKED      // like INSTANCED, with 20-byte half float/quaternion instances instead of mat4s
+};
+#define DRAW_MODES 4
+
+// Order of the visible cubes inside each LOD group, by view depth
+enum class SortOrder {
+    NONE,           // index order
+    FRONT_TO_BACK,  // opaque: nearest first, so hidden fragments fail the depth test early
+    BACK_TO_FRONT   // for blended passes
+};
+
+// Level of detail of a visible cube in instanced mode
+#define LOD_LEVELS 2    // 0: full cube mesh, 1: flat shaded point sprite impostor
+
+// Uniform buffer binding points shared by every program
+#define FRAME_BLOCK_BINDING 0   // the Frame block, see FrameBlock
+
+// std140 layout of the Frame uniform block (shaders/frame_block.glsl):
+// camera and directional light, written once per frame
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 view_pos;         // vec3, std140 pads it to 16 bytes
+    glm::vec4 light_direction;  // DirectionalLight, every vec3 member padded the same way
+    glm::vec4 light_ambient;
+    glm::vec4 light_diffuse;
+    glm::vec4 light_specular;
+};
+static_assert(sizeof(FrameBlock) == 208, "FrameBlock must match the std140 Frame block");
+
+// Texture units of the light buffers, after the two material maps
+#define LIGHT_BUFFER_UNIT 2     // PointLight array
+#define CLUSTER_GRID_UNIT 3     // LightClusters::grid
+#define CLUSTER_LIGHTS_UNIT 4   // LightClusters::indices
+#define GBUFFER_UNIT 5          // G-buffer albedo, normal and depth, read by the deferred lighting passes
 
 
 class Engine{
 public:
     
-    int init(int cubes, bool imgui, bool save);
-    void render_loop();
+    int init(int cubes, bool imgui, bool save, DrawMode mode = DrawMode::DIRECT, uint64_t seed = 1);
+    // light_benchmark: sweep the light count with and without clustering instead of running interactively
+    void render_loop(bool light_benchmark = false);
 
 private:
     GLFWwindow * window;
     float past_time = 0;
+    float frame_time = 0;   // glfwGetTime() sampled once per frame, shared by every animation
     float dtime;
     PerfTracker tracker;
+    ThreadPool pool;
+    std::vector<double> worker_times;
     bool is_imgui = true;
 
     float cube[192] = {
@@ -90,11 +150,83 @@ private:
     unsigned int cVBO; // Buffer for cube indices, just a single one
     unsigned int cEBO; // same as above
     unsigned int cVAO;
+    StreamBuffer instance_ring; // per-cube model matrices (or packed instances) for the instanced paths
+    long long instance_bytes = 0;
+    unsigned int frameUBO;      // FrameBlock, bound at FRAME_BLOCK_BINDING
+    unsigned int lightTBO;      // PointLight per light, rewritten in place once per frame
+    unsigned int light_texture; // buffer texture over lightTBO
+    std::vector<PointLight> light_data;
+    long long light_bytes = 0;  // store capacity
+    unsigned int clusterTBO[2];         // cluster grid, light index list
+    unsigned int cluster_textures[2];
+    long long cluster_bytes[2] = {0, 0};
+    unsigned int staticVBO;     // per-cube tr/sc/rot for the animated path, uploaded once
+    int static_count = 0;
 
+    // Scene storage, sized to the requested cubes (rounded up to SCENE_CHUNK)
+    // and grown when "Num Cubes" is raised; new cubes come from the same seed
+    uint64_t seed = 1;
+    size_t scene_capacity = 0;
     std::vector<glm::vec3> tr;
     std::vector<glm::vec3> sc;
     std::vector<glm::vec3> rot;
-    std::vector<glm::mat4> trans;
+    aligned_vector<glm::mat4> trans;
+    aligned_vector<glm::mat3> normals;  // direct mode: normal matrices, at the index of their cube in trans[]
+    SceneSoA scene;             // SoA copy of tr/sc/rot read by the transform kernel
+    TransformKernels transform_kernel;
+    PackKernels pack_kernel;
+
+    // Frustum culling of the cube field (direct and instanced modes)
+    bool culling = true;
+    CullKernels cull_kernel;
+    aligned_vector<uint32_t> visible;   // indices of the cubes left after culling
+    int cube_instances = 0;             // cubes (lights excluded) submitted this frame
+    bool bvh_culling = true;            // hierarchical instead of flat culling
+    CubeBVH bvh;
+
+    // Software occlusion culling of the frustum survivors against the backpack and the nearest cubes
+    bool occlusion_culling = false;
+    int max_occluders = 64;             // cubes rasterized as occluders, largest on screen first
+    OcclusionCuller occlusion;
+
+    // Clustered forward shading: lights binned on the CPU into a tile x depth
+    // slice grid, so every fragment only loops over the lights of its cluster.
+    // Lights stop at the distance where their attenuation drops to light_cutoff
+    bool clustered_lights = true;
+    float light_cutoff = .05f;
+    LightClusters clusters;
+
+    // Distance LOD (instanced mode): cubes smaller than lod_pixels on screen become impostors.
+    // visible[] holds the LOD 0 cubes first, then the LOD 1 ones
+    float lod_pixels = 4.f;
+    int lod_counts[LOD_LEVELS] = {0, 0};
+    aligned_vector<uint32_t> lod_scratch;
+    unsigned int impostorVAO;
+
+    // Depth sort of the visible cubes (lod_scratch doubles as the value scratch)
+    SortOrder sort_order = SortOrder::FRONT_TO_BACK;
+    aligned_vector<uint32_t> sort_keys, sort_keys_tmp;
+    std::vector<size_t> sort_hist;      // radix sort block histograms, kept across frames
+
+    // GL_SAMPLES_PASSED of the cube draws, read back STREAM_FRAMES frames later
+    unsigned int overdraw_queries[STREAM_FRAMES];
+    bool overdraw_pending[STREAM_FRAMES] = {};
+    int overdraw_frame = 0;
+    double overdraw = 0.0;
+
+    // GL_TIME_ELAPSED of the whole draw(), read back the same way
+    unsigned int gpu_time_queries[STREAM_FRAMES];
+    bool gpu_time_pending[STREAM_FRAMES] = {};
+    int gpu_time_frame = 0;
+    double gpu_time = 0.0;
+
+    // Deferred shading: the cubes write a G-buffer, then the directional light
+    // is applied per pixel and every point light over the box around its radius
+    bool deferred = false;
+    GBuffer gbuffer;
+    unsigned int volumeVAO, volumeVBO, volumeEBO;
+    unsigned int emptyVAO;      // the full screen triangle has no attributes
+    glm::vec3 impostor_albedo = glm::vec3(1.f);
 
     int cubes_tot;
     float spread = 1.0f;
@@ -112,8 +244,73 @@ private:
     int height;
 
     glm::mat4 projection;
-    Shader shader;
+    DrawMode draw_mode = DrawMode::DIRECT;
     Shader light_shader;
+    Shader instanced_light_shader;
+    Shader animated_light_shader;
+    Shader impostor_shader;
+    Shader packed_impostor_shader;
+
+    // Uniform handles, resolved once in init_shaders so the draw loops set
+    // uniforms without building or hashing a name. Camera and directional
+    // light come from the Frame block instead.
+
+    // vertex_animated.glsl: the matrices are built on the GPU from these
+    struct AnimationUniforms {
+        Uniform<float> time;
+        Uniform<float> spread;
+        Uniform<float> rot_speed;
+        Uniform<bool> orbit;
+        void resolve(Shader &s);
+    };
+    // the cube programs, forward (per variant) and G-buffer
+    struct CubeUniforms {
+        Uniform<glm::mat4> model;
+        Uniform<glm::mat3> normal_matrix;
+        Uniform<int> num_lights;
+        Uniform<float> light_cutoff;
+        Uniform<bool> clustered;
+        Uniform<glm::vec4> cluster_scale;
+        AnimationUniforms animation;    // location -1 outside the animated programs
+        void resolve(Shader &s);
+    };
+    // fragment_impostor.glsl point sprites
+    struct ImpostorUniforms {
+        Uniform<float> pixel_scale;
+        Uniform<glm::vec3> albedo;
+        void resolve(Shader &s);
+    };
+    Uniform<glm::mat4> light_model;
+    AnimationUniforms animated_light_uniforms;
+    ImpostorUniforms impostor_uniforms;
+    ImpostorUniforms packed_impostor_uniforms;
+
+    // Forward cube programs (fragment.glsl), one variant cache per draw mode.
+    // A variant is specialized on cube_defines(): with few lights the exact
+    // count is baked in and the clusters are not used
+    using CubeVariants = ShaderVariants<CubeUniforms>;
+    CubeVariants cube_variants[DRAW_MODES];
+    bool specialize_shaders = true;
+    int lighting_model = LIGHTING_PHONG;
+    bool specular_map = false;          // textures/container2_specular.png loaded
+    bool cpu_normals = true;            // normal matrices from the CPU (the G-buffer programs always use them)
+    CubeVariants::Variant *frame_variant = nullptr;     // drawn with in this frame
+    CubeVariants::Variant *gpu_time_variants[STREAM_FRAMES] = {};  // per timer query
+
+    // Deferred path: G-buffer variants of the cube programs and the lighting passes
+    Shader gbuffer_shader;
+    Shader gbuffer_instanced_shader;
+    Shader gbuffer_animated_shader;
+    Shader gbuffer_packed_shader;
+    Shader deferred_shader;
+    Shader light_volume_shader;
+    CubeUniforms gbuffer_uniforms;
+    CubeUniforms gbuffer_instanced_uniforms;
+    CubeUniforms gbuffer_animated_uniforms;
+    CubeUniforms gbuffer_packed_uniforms;
+    Uniform<glm::mat4> deferred_inv_view_projection;
+    Uniform<glm::mat4> volume_inv_view_projection;
+    Uniform<float> volume_light_cutoff;
 
     struct Light
     {
@@ -123,10 +320,16 @@ private:
 
     Model model_obj;
     Shader model_shader;
+    Uniform<glm::mat4> model_uniform;
+    glm::mat4 model_transform;          // fixed, built once at init
+
+    // The draws of the geometry pass, submitted in draw() and executed in state order
+    RenderQueue queue;
     
 
     // texture placeholder
     unsigned int texture[2];
+    unsigned int material_sampler;      // their wrap and filtering
 
 
     // Lights variables
@@ -139,8 +342,48 @@ private:
     void init_shaders();
     void init_VAO();
     void init_textures();
+    void set_instance_attribs(unsigned int vao, size_t offset);
+    void set_normal_attribs(unsigned int vao, size_t offset);
+    void set_static_attribs(unsigned int vao, size_t offset);
+    void set_packed_attribs(unsigned int vao, size_t offset);
+    void upload_static_instances();
+    void generate_scene(size_t begin, size_t end);
+    void fit_scene_storage();
+    size_t scene_bytes() const;
 
 
+    void cull_cubes(glm::mat4 &view);
+    void occlusion_cull(glm::mat4 &view);
+    void select_lods();
+    void sort_visible(glm::mat4 &view);
+    void begin_overdraw_query();
+    void end_overdraw_query();
+    void begin_gpu_timer();
+    void end_gpu_timer();
+    void fit_gbuffer();
+    void draw_deferred_lighting(glm::mat4 &view);
+    void update_scene_cache();
+    void update_lights();
+    bool needs_normals() const;
+    void update_transforms(glm::mat4 * out, glm::mat3 * normals_out);
+    void update_packed(void * out);
+    void update_frame_block(glm::mat4 &view);
+    void update_light_buffer(glm::mat4 &view);
+    void upload_light_texture(unsigned int buffer, const void *data, long long bytes, long long &allocated);
+    void run_light_benchmark();
+    void set_impostor_uniforms(Shader &s, ImpostorUniforms &u);
+    ShaderDefines cube_defines() const;
+    CubeVariants::Variant &cube_variant();
+    bool uses_clusters() const;
+    void set_cube_uniforms(Shader &s, CubeUniforms &u);
+    void set_animation_uniforms(Shader &s, AnimationUniforms &u, bool orbit);
+    uint16_t add_cube_material();
+    uint16_t add_cube_program(Shader &s, CubeUniforms &u);
+    float queue_depth(const glm::vec4 &depth_row, const glm::vec3 &position) const;
+    void submit_cubes_direct(glm::mat4 &view);
+    void submit_cubes_instanced();
+    void submit_cubes_animated();
+    void submit_model(glm::mat4 &view);
     void draw();
     void draw_imgui();
 };
\ No newline at end of file
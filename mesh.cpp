@@ -1,4 +1,5 @@
 #include "mesh.h"
+#include "glState.h"
 
 Mesh::Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures){
     this->vertices = vertices;
@@ -35,12 +36,13 @@ void Mesh::setupMesh(){
 }
 
 
-void Mesh::Draw(Shader &shader){
-    glBindVertexArray(VAO);
+void Mesh::resolve_material(const Shader &shader){
+    // material.texture_diffuseN / material.texture_specularN on unit i;
+    // the model textures carry their own filtering and wrap modes (sampler 0)
+    material = RenderMaterial();
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
-    for(unsigned int i = 0; i < textures.size(); i++){
-        glActiveTexture(GL_TEXTURE0 + i);
+    for(unsigned int i = 0; i < textures.size() && i < RENDER_MAX_TEXTURES; i++){
         std::string number;
         std::string name = textures[i].type;
         if(name == "texture_diffuse"){
@@ -50,12 +52,12 @@ void Mesh::Draw(Shader &shader){
             number = std::to_string(specularNr++);
         }
 
-
-        shader.setInt(("material." + name + number).c_str(), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        material.add_texture(i, GL_TEXTURE_2D, textures[i].id);
+        material.add_sampler(shader.uniform<int>("material." + name + number), i);
     }
+}
 
-    // draw mesh
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-}
\ No newline at end of file
+void Mesh::submit(RenderQueue &queue, uint16_t program, float depth){
+    RenderPacket packet = {VAO, (uint32_t)indices.size(), 0, RENDER_NO_TRANSFORM, program, queue.add_material(material), GL_TRIANGLES};
+    queue.submit(RenderPass::OPAQUE, packet, depth);
+}
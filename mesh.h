@@ -12,6 +12,7 @@
 #include <vector>
 
 #include "shader.h"
+#include "renderQueue.h"
 
 
 struct Vertex {
@@ -34,11 +35,14 @@ public:
     std::vector<Texture> textures;
 
     Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures);
-    void Draw(Shader &shader);
+    // Looks up the sampler uniforms of shader and assigns the texture units, once
+    void resolve_material(const Shader &shader);
+    void submit(RenderQueue &queue, uint16_t program, float depth);
 
 private:
 
     unsigned int VAO, VBO, EBO;
+    RenderMaterial material;    // textures and sampler uniforms, from resolve_material
 
     void setupMesh();
 
@@ -2,9 +2,15 @@
 
 
 
-void Model::Draw(Shader &shader){
+void Model::resolve_materials(const Shader &shader){
     for(unsigned int i = 0; i < meshes.size(); i++){
-        meshes[i].Draw(shader);
+        meshes[i].resolve_material(shader);
+    }
+}
+
+void Model::submit(RenderQueue &queue, uint16_t program, float depth){
+    for(unsigned int i = 0; i < meshes.size(); i++){
+        meshes[i].submit(queue, program, depth);
     }
 }
 
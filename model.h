@@ -16,7 +16,11 @@ public:
         loadModel(path);
     }
 
-    void Draw(Shader &shader);
+    // Resolves every mesh's material against shader, after loading and whenever it is rebuilt
+    void resolve_materials(const Shader &shader);
+    // One packet per mesh, drawn with program (registered in queue for the shader above)
+    void submit(RenderQueue &queue, uint16_t program, float depth);
+    const std::vector<Mesh> &getMeshes() const { return meshes; }
 private:
     // model data
     std::vector<Mesh> meshes;
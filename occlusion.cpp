@@ -0,0 +1,280 @@
+#include "occlusion.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OCCLUSION_SSE2 1
+#endif
+
+// Unit cube corners (bit 0 = x, bit 1 = y, bit 2 = z) and its faces, counter clockwise from outside
+static const uint32_t cube_corner_tris[36] = {
+    1, 3, 7,  1, 7, 5,  // +x
+    0, 4, 6,  0, 6, 2,  // -x
+    2, 6, 7,  2, 7, 3,  // +y
+    0, 1, 5,  0, 5, 4,  // -y
+    4, 5, 7,  4, 7, 6,  // +z
+    0, 2, 3,  0, 3, 1   // -z
+};
+
+void OcclusionCuller::begin(const glm::mat4 &v, const glm::mat4 &p){
+    view = v;
+    projection = p;
+    view_projection = p * v;
+    clip.clear();
+    tri_idx.clear();
+
+    if(levels.empty()){
+        for(int w = OCCLUSION_WIDTH, h = OCCLUSION_HEIGHT; w >= 1 && h >= 1; w /= 2, h /= 2){
+            levels.emplace_back((size_t)w * h);
+        }
+    }
+    std::fill(levels[0].begin(), levels[0].end(), 1.f);
+}
+
+void OcclusionCuller::add_mesh(const float *positions, size_t stride, size_t vertex_count,
+                               const uint32_t *indices, size_t index_count, const glm::mat4 &model, ThreadPool &pool){
+    size_t base = clip.size();
+    clip.resize(base + vertex_count);
+    glm::mat4 mvp = view_projection * model;
+    pool.parallel_for(0, vertex_count, 4096, 1, [&](size_t b, size_t e, unsigned){
+        for(size_t i = b; i < e; i++){
+            const float *p = (const float*)((const char*)positions + i * stride);
+            clip[base + i] = mvp * glm::vec4(p[0], p[1], p[2], 1.f);
+        }
+    });
+    for(size_t i = 0; i < index_count; i++){
+        tri_idx.push_back((uint32_t)base + indices[i]);
+    }
+}
+
+void OcclusionCuller::add_cube(const glm::mat4 &model){
+    uint32_t base = (uint32_t)clip.size();
+    glm::mat4 mvp = view_projection * model;
+    for(int c = 0; c < 8; c++){
+        clip.push_back(mvp * glm::vec4(c & 1 ? .5f : -.5f, c & 2 ? .5f : -.5f, c & 4 ? .5f : -.5f, 1.f));
+    }
+    for(uint32_t i : cube_corner_tris){
+        tri_idx.push_back(base + i);
+    }
+}
+
+void OcclusionCuller::setup(size_t t){
+    Tri &tri = tris[t];
+    tri.valid = false;
+    for(int v = 0; v < 3; v++){
+        const glm::vec4 &c = clip[tri_idx[3 * t + v]];
+        // triangles crossing the near plane are dropped: missing an occluder is always safe
+        if(c.w < 1e-5f || c.z < -c.w){
+            return;
+        }
+        float inv = 1.f / c.w;
+        tri.x[v] = (c.x * inv * .5f + .5f) * OCCLUSION_WIDTH;
+        tri.y[v] = (c.y * inv * .5f + .5f) * OCCLUSION_HEIGHT;
+        tri.z[v] = c.z * inv;
+    }
+    // counter clockwise is front facing, back faces and slivers are skipped
+    float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+    if(!(area > 1e-6f)){
+        return;
+    }
+    // pixel centres at +0.5
+    tri.minx = std::max(0, (int)std::ceil(std::min({tri.x[0], tri.x[1], tri.x[2]}) - .5f));
+    tri.maxx = std::min(OCCLUSION_WIDTH - 1, (int)std::floor(std::max({tri.x[0], tri.x[1], tri.x[2]}) - .5f));
+    tri.miny = std::max(0, (int)std::ceil(std::min({tri.y[0], tri.y[1], tri.y[2]}) - .5f));
+    tri.maxy = std::min(OCCLUSION_HEIGHT - 1, (int)std::floor(std::max({tri.y[0], tri.y[1], tri.y[2]}) - .5f));
+    tri.valid = tri.minx <= tri.maxx && tri.miny <= tri.maxy;
+}
+
+void OcclusionCuller::raster_band(int y0, int y1){
+    float *depth = levels[0].data();
+    for(const Tri &t : tris){
+        if(!t.valid || t.maxy < y0 || t.miny >= y1){
+            continue;
+        }
+
+        // edge functions E(p) = a * px + b * py + c, positive inside
+        float a[3], b[3], c[3];
+        for(int e = 0; e < 3; e++){
+            int i = e, j = (e + 1) % 3;
+            a[e] = -(t.y[j] - t.y[i]);
+            b[e] = t.x[j] - t.x[i];
+            c[e] = -(a[e] * t.x[i] + b[e] * t.y[i]);
+        }
+        // depth plane z = za * px + zb * py + zc
+        float area = c[0] + c[1] + c[2];
+        float l1x = a[2] / area, l1y = b[2] / area, l1c = c[2] / area;  // weight of vertex 1 is the edge 2->0
+        float l2x = a[0] / area, l2y = b[0] / area, l2c = c[0] / area;  // weight of vertex 2 is the edge 0->1
+        float dz1 = t.z[1] - t.z[0], dz2 = t.z[2] - t.z[0];
+        float za = l1x * dz1 + l2x * dz2;
+        float zb = l1y * dz1 + l2y * dz2;
+        float zc = t.z[0] + l1c * dz1 + l2c * dz2;
+
+        int ys = std::max(t.miny, y0), ye = std::min(t.maxy, y1 - 1);
+        int xs = t.minx & ~3;
+        for(int y = ys; y <= ye; y++){
+            float py = y + .5f;
+            float *row = depth + (size_t)y * OCCLUSION_WIDTH;
+            // the per row terms are added last on both paths, so they agree bit for bit
+            float er[3];
+            for(int e = 0; e < 3; e++){
+                er[e] = b[e] * py + c[e];
+            }
+            float zr = zb * py + zc;
+#ifdef OCCLUSION_SSE2
+            if(simd){
+                const __m128 lane = _mm_setr_ps(.5f, 1.5f, 2.5f, 3.5f);
+                __m128 vea[3], ver[3];
+                for(int e = 0; e < 3; e++){
+                    vea[e] = _mm_set1_ps(a[e]);
+                    ver[e] = _mm_set1_ps(er[e]);
+                }
+                __m128 vza = _mm_set1_ps(za), vzr = _mm_set1_ps(zr);
+                for(int x = xs; x <= t.maxx; x += 4){
+                    __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane);
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(vea[0], px), ver[0]), _mm_setzero_ps());
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(vea[1], px), ver[1]), _mm_setzero_ps()));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(vea[2], px), ver[2]), _mm_setzero_ps()));
+                    if(_mm_movemask_ps(inside) == 0){
+                        continue;
+                    }
+                    __m128 z = _mm_add_ps(_mm_mul_ps(vza, px), vzr);
+                    __m128 old = _mm_load_ps(row + x);
+                    __m128 nearer = _mm_min_ps(old, z);
+                    _mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+                }
+                continue;
+            }
+#endif
+            for(int x = t.minx; x <= t.maxx; x++){
+                float px = x + .5f;
+                if(a[0] * px + er[0] >= 0.f && a[1] * px + er[1] >= 0.f && a[2] * px + er[2] >= 0.f){
+                    row[x] = std::min(row[x], za * px + zr);
+                }
+            }
+        }
+    }
+}
+
+void OcclusionCuller::build_pyramid(){
+    int w = OCCLUSION_WIDTH, h = OCCLUSION_HEIGHT;
+    for(size_t l = 1; l < levels.size(); l++){
+        const float *src = levels[l - 1].data();
+        float *dst = levels[l].data();
+        int dw = w / 2, dh = h / 2;
+        for(int y = 0; y < dh; y++){
+            for(int x = 0; x < dw; x++){
+                const float *s = src + (size_t)(2 * y) * w + 2 * x;
+                dst[(size_t)y * dw + x] = std::max(std::max(s[0], s[1]), std::max(s[w], s[w + 1]));
+            }
+        }
+        w = dw;
+        h = dh;
+    }
+}
+
+void OcclusionCuller::rasterize(ThreadPool &pool){
+    size_t count = tri_idx.size() / 3;
+    tris.resize(count);
+    pool.parallel_for(0, count, 1024, 1, [&](size_t b, size_t e, unsigned){
+        for(size_t t = b; t < e; t++){
+            setup(t);
+        }
+    });
+
+    // bands cover disjoint rows, so they write the depth buffer without locks
+    pool.parallel_for(0, OCCLUSION_HEIGHT / OCCLUSION_BAND, 1, 1, [&](size_t b, size_t e, unsigned){
+        for(size_t band = b; band < e; band++){
+            raster_band((int)band * OCCLUSION_BAND, (int)(band + 1) * OCCLUSION_BAND);
+        }
+    });
+
+    build_pyramid();
+}
+
+bool OcclusionCuller::sphere_visible(const glm::vec3 &center, float r) const {
+    glm::vec4 cv = view * glm::vec4(center, 1.f);
+    // the camera looks down -z: the nearest point of the sphere is at cv.z + r
+    float zn = cv.z + r;
+    if(-zn <= 1e-4f){
+        return true;
+    }
+
+    // screen rectangle of the view space box around the sphere
+    float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+    for(int k = 0; k < 8; k++){
+        glm::vec4 p = projection * glm::vec4(cv.x + (k & 1 ? r : -r), cv.y + (k & 2 ? r : -r), k & 4 ? zn : cv.z - r, 1.f);
+        float inv = 1.f / p.w;
+        x0 = std::min(x0, p.x * inv);
+        x1 = std::max(x1, p.x * inv);
+        y0 = std::min(y0, p.y * inv);
+        y1 = std::max(y1, p.y * inv);
+    }
+    int px0 = std::max(0, (int)((x0 * .5f + .5f) * OCCLUSION_WIDTH));
+    int px1 = std::min(OCCLUSION_WIDTH - 1, (int)((x1 * .5f + .5f) * OCCLUSION_WIDTH));
+    int py0 = std::max(0, (int)((y0 * .5f + .5f) * OCCLUSION_HEIGHT));
+    int py1 = std::min(OCCLUSION_HEIGHT - 1, (int)((y1 * .5f + .5f) * OCCLUSION_HEIGHT));
+    if(px0 > px1 || py0 > py1){
+        // off the buffer: leave it to the frustum test
+        return true;
+    }
+
+    glm::vec4 nearest = projection * glm::vec4(cv.x, cv.y, zn, 1.f);
+    float depth = nearest.z / nearest.w;
+
+    // coarsest level where the rectangle spans at most 2x2 texels
+    size_t l = 0;
+    while(l + 1 < levels.size() && ((px1 >> l) - (px0 >> l) > 1 || (py1 >> l) - (py0 >> l) > 1)){
+        l++;
+    }
+    int w = OCCLUSION_WIDTH >> l;
+    float farthest = -1.f;
+    for(int y = py0 >> l; y <= (py1 >> l); y++){
+        for(int x = px0 >> l; x <= (px1 >> l); x++){
+            farthest = std::max(farthest, levels[l][(size_t)y * w + x]);
+        }
+    }
+    return depth <= farthest;
+}
+
+size_t OcclusionCuller::check(ThreadPool &pool){
+    // a 4x4 wall 5 units in front of the camera, in three rotated copies
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.f), 2.f, .1f, 100.f);
+    OcclusionCuller culler;
+    size_t failures = 0;
+    size_t mismatched = 0;
+    for(int pass = 0; pass < 2; pass++){
+        culler.simd = pass == 0;
+        culler.begin(view, projection);
+        for(int k = 0; k < 3; k++){
+            glm::mat4 m = glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, -5.f - k));
+            m = glm::rotate(m, .3f * k, glm::vec3(0.f, 0.f, 1.f));
+            culler.add_cube(glm::scale(m, glm::vec3(4.f, 4.f, .1f)));
+        }
+        culler.rasterize(pool);
+
+        // behind the wall, in front of it, beside it, crossing the near plane
+        failures += culler.sphere_visible(glm::vec3(0.f, 0.f, -20.f), .5f);
+        failures += !culler.sphere_visible(glm::vec3(0.f, 0.f, -3.f), .5f);
+        failures += !culler.sphere_visible(glm::vec3(15.f, 0.f, -20.f), .5f);
+        failures += !culler.sphere_visible(glm::vec3(0.f, 0.f, -.2f), .5f);
+        failures += !culler.sphere_visible(glm::vec3(0.f, 0.f, -5.5f), 1.f);
+    }
+#ifdef OCCLUSION_SSE2
+    // pass 1 left the scalar depth buffer, redo the SIMD one next to it
+    aligned_vector<float> scalar = culler.levels[0];
+    culler.simd = true;
+    culler.rasterize(pool);
+    for(size_t i = 0; i < scalar.size(); i++){
+        mismatched += scalar[i] != culler.levels[0][i];
+    }
+#endif
+    std::cout << "[Occlusion] self-check: " << failures << " wrong sphere tests, " << mismatched
+              << " pixels differing between the SSE2 and scalar rasterizers" << std::endl;
+    return failures + mismatched;
+}
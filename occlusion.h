@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "alignedAllocator.h"
+#include "threadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_BAND 16       // rows rasterized by one task
+
+/**
+ * Software occlusion culling on a small CPU depth buffer.
+ *
+ * A few large occluders are rasterized (depth only, back faces skipped) at
+ * OCCLUSION_WIDTH x OCCLUSION_HEIGHT, in horizontal bands spread over the
+ * thread pool, 4 pixels at a time with SSE2. A max-depth (farthest) pyramid
+ * is then built over it, and a bounding sphere is occluded when its nearest
+ * depth lies behind every texel of the pyramid level where its screen
+ * rectangle covers at most 2x2 texels.
+ *
+ * Depths are NDC z in [-1, 1]; row 0 is the bottom of the screen.
+ */
+class OcclusionCuller {
+public:
+    void begin(const glm::mat4 &view, const glm::mat4 &projection);
+
+    // Queues the triangles of an indexed mesh; positions are read as 3 floats every `stride` bytes
+    void add_mesh(const float *positions, size_t stride, size_t vertex_count,
+                  const uint32_t *indices, size_t index_count, const glm::mat4 &model, ThreadPool &pool);
+    // Queues the 12 triangles of the unit cube transformed by model
+    void add_cube(const glm::mat4 &model);
+
+    // Rasterizes everything queued since begin() and builds the pyramid
+    void rasterize(ThreadPool &pool);
+
+    bool sphere_visible(const glm::vec3 &center, float radius) const;
+
+    size_t triangles() const { return tri_idx.size() / 3; }
+
+    // Rasterizes a few walls with both rasterizers, compares the depth buffers
+    // and tests spheres behind, in front of, beside them and across the near
+    // plane; prints and returns the number of failures
+    static size_t check(ThreadPool &pool);
+
+private:
+    struct Tri {
+        float x[3], y[3], z[3];     // pixels and NDC depth
+        int minx, maxx, miny, maxy; // pixel bounds, inclusive
+        bool valid;
+    };
+
+    glm::mat4 view, projection, view_projection;
+    bool simd = true;   // false: scalar rows even where SSE2 is available (for check)
+
+    std::vector<glm::vec4> clip;        // clip space vertices of the queued occluders
+    std::vector<uint32_t> tri_idx;
+    std::vector<Tri> tris;
+
+    // levels[0] is the depth buffer, every next level the max of 2x2 texels
+    std::vector<aligned_vector<float>> levels;
+
+    void setup(size_t t);
+    void raster_band(int y0, int y1);
+    void build_pyramid();
+};
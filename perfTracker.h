@@ -24,14 +24,75 @@ public:
     int drawCalls = 0;
     int trisThisFrame = 0;
 
-    // State change counters
+    // State change counters: binds issued to GL, and the ones the state
+    // cache (glState.h) dropped because nothing would change
     int shaderBinds = 0;
+    int shaderBindsElided = 0;
     int textureBinds = 0;
+    int textureBindsElided = 0;
+    long long stateChanges = 0;     // every tracked bind, VAOs, buffers and samplers included
+    long long stateElided = 0;
+    long long uniformUpdates = 0;
+    // Forward cube program variant drawn with (ShaderDefines::key, -1: none) and its build time
+    long long shaderVariant = -1;
+    double variantBuildTime = 0.0;
+
+    // Time each thread pool worker spent in parallel loops this frame (ms)
+    std::vector<double> workerTimes;
 
     // Memory tracking (in bytes)
     long long totalVramAllocated = 0;
     long long dataUploadedThisFrame = 0;
 
+    // Frustum culling of the cube field
+    int visibleInstances = 0;
+    int culledInstances = 0;
+    double cullTime = 0.0;
+
+    // Software occlusion culling: cubes rejected, occluder triangles drawn, raster (incl. Hi-Z) and test cost
+    int occludedInstances = 0;
+    int occluderTriangles = 0;
+    double rasterTime = 0.0;
+    double occlusionTestTime = 0.0;
+
+    // Visible cubes drawn as full meshes (LOD0) and as impostors (LOD1)
+    int lodInstances[2] = {0, 0};
+
+    // Bytes of one streamed cube instance (64 for a mat4, less when packed)
+    long long instanceSize = 0;
+
+    // Time spent waiting on fences before writing streamed data (ms)
+    double fenceWaitTime = 0.0;
+
+    // Host memory of the scene arrays, now and at most so far (bytes)
+    long long sceneMemory = 0;
+    long long peakSceneMemory = 0;
+
+    // Depth sort of the visible cubes (ms) and samples passing the depth test per pixel
+    double sortTime = 0.0;
+    double overdraw = 0.0;
+
+    // Draws submitted to the render queue and the time spent sorting their keys (ms)
+    long long renderPackets = 0;
+    double queueSortTime = 0.0;
+
+    // Point lights, light/cluster pairs binned by the clustered light culling and its CPU cost (ms)
+    int lightCount = 0;
+    long long lightAssignments = 0;
+    double lightCullTime = 0.0;
+
+    // GPU time of the whole draw (GL_TIME_ELAPSED, a few frames late) and whether it took the deferred path
+    double gpuTime = 0.0;
+    bool deferred = false;
+
+    // Startup cost of Engine::init and of the scene generation inside it (ms)
+    double startupTime = 0.0;
+    double sceneGenTime = 0.0;
+    // Building the shader programs, and how many came from the binary cache
+    double shaderTime = 0.0;
+    int shaderCacheHits = 0;
+    int shaderPrograms = 0;
+
     // CSV
     std::ofstream csvFile;
     bool csvEnabled = false;
@@ -42,6 +103,11 @@ private:
     size_t historySize = 100;
 
 public:
+    // Must be called before init() so the CSV header gets one column per worker
+    void initWorkers(size_t workers) {
+        workerTimes.assign(workers, 0.0);
+    }
+
     void init(bool &save, size_t history = 100, const std::string &csvPath = "stats.csv") {
         historySize = history;
         frameHistory.resize(historySize, 0.0);
@@ -50,7 +116,11 @@ public:
             csvFile.open(csvPath, std::ios::out);
             if (csvFile.is_open()) {
                 csvEnabled = true;
-                csvFile << "FPS,FrameTime(ms),MinFrame(ms),MaxFrame(ms),AvgFrame(ms),CPUTime(ms),GPUWait(ms),DrawCalls,Triangles,VRAM(MB),Upload(KB),\n";
+                csvFile << "FPS,FrameTime(ms),MinFrame(ms),MaxFrame(ms),AvgFrame(ms),CPUTime(ms),GPUWait(ms),GPUTime(ms),Deferred,DrawCalls,Triangles,ShaderBinds,ShaderBindsElided,TextureBinds,TextureBindsElided,StateChanges,StateElided,VRAM(MB),Upload(KB),InstanceBytes,FenceWait(ms),Visible,Culled,Cull(ms),Occluded,OccluderTris,Raster(ms),OcclusionTest(ms),LOD0,LOD1,Sort(ms),Packets,QueueSort(ms),Overdraw,UniformUpdates,ShaderVariant,VariantBuild(ms),Lights,LightAssign,LightCull(ms),Startup(ms),SceneGen(ms),Shaders(ms),ShaderCacheHits,SceneMem(MB),PeakSceneMem(MB),";
+                for (size_t w = 0; w < workerTimes.size(); w++) {
+                    csvFile << "Worker" << w << "(ms),";
+                }
+                csvFile << "\n";
             } else {
                 std::cerr << "[PerfTracker] Failed to open CSV file: " << csvPath << "\n";
             }
@@ -64,8 +134,22 @@ public:
         drawCalls = 0;
         trisThisFrame = 0;
         shaderBinds = 0;
+        shaderBindsElided = 0;
         textureBinds = 0;
+        textureBindsElided = 0;
         dataUploadedThisFrame = 0;
+        fenceWaitTime = 0.0;
+        visibleInstances = 0;
+        culledInstances = 0;
+        cullTime = 0.0;
+        occludedInstances = 0;
+        occluderTriangles = 0;
+        rasterTime = 0.0;
+        occlusionTestTime = 0.0;
+        lodInstances[0] = lodInstances[1] = 0;
+        sortTime = 0.0;
+        renderPackets = 0;
+        queueSortTime = 0.0;
     }
 
     void beginCpuRender() {
@@ -102,24 +186,129 @@ public:
                     << avgFrame << ","
                     << cpuRenderTime << ","
                     << gpuWaitTime << ","
+                    << gpuTime << ","
+                    << deferred << ","
                     << drawCalls << ","
                     << trisThisFrame << ","
+                    << shaderBinds << ","
+                    << shaderBindsElided << ","
+                    << textureBinds << ","
+                    << textureBindsElided << ","
+                    << stateChanges << ","
+                    << stateElided << ","
                     << totalVramAllocated / (1024.0 * 1024.0) << ","
                     << dataUploadedThisFrame / 1024.0 << ","
-                    << "\n";
+                    << instanceSize << ","
+                    << fenceWaitTime << ","
+                    << visibleInstances << ","
+                    << culledInstances << ","
+                    << cullTime << ","
+                    << occludedInstances << ","
+                    << occluderTriangles << ","
+                    << rasterTime << ","
+                    << occlusionTestTime << ","
+                    << lodInstances[0] << ","
+                    << lodInstances[1] << ","
+                    << sortTime << ","
+                    << renderPackets << ","
+                    << queueSortTime << ","
+                    << overdraw << ","
+                    << uniformUpdates << ","
+                    << shaderVariant << ","
+                    << variantBuildTime << ","
+                    << lightCount << ","
+                    << lightAssignments << ","
+                    << lightCullTime << ","
+                    << startupTime << ","
+                    << sceneGenTime << ","
+                    << shaderTime << ","
+                    << shaderCacheHits << ","
+                    << sceneMemory / (1024.0 * 1024.0) << ","
+                    << peakSceneMemory / (1024.0 * 1024.0) << ",";
+            for (double t : workerTimes) {
+                csvFile << t << ",";
+            }
+            csvFile << "\n";
         }
     }
 
     // --- Counter Methods ---
     void countDrawCall() { drawCalls++; }
     void countTriangles(int tris) { trisThisFrame += tris; }
-    void countShaderBind() { shaderBinds++; }
-    void countTextureBind() { textureBinds++; }
+    void countShaderBind(bool issued = true) { issued ? shaderBinds++ : shaderBindsElided++; }
+    void countTextureBind(bool issued = true) { issued ? textureBinds++ : textureBindsElided++; }
+    void trackStateChanges(long long issued, long long elided) {
+        stateChanges = issued;
+        stateElided = elided;
+    }
 
     // --- Memory Tracking Methods ---
     void trackVramAllocation(long long bytes) { totalVramAllocated += bytes; }
     void trackVramDeallocation(long long bytes) { totalVramAllocated -= bytes; }
     void trackDataUpload(long long bytes) { dataUploadedThisFrame += bytes; }
+    void trackSceneMemory(long long bytes) {
+        sceneMemory = bytes;
+        peakSceneMemory = std::max(peakSceneMemory, bytes);
+    }
+    void trackFenceWait(double ms) { fenceWaitTime += ms; }
+    void trackInstanceSize(long long bytes) { instanceSize = bytes; }
+
+    // --- Culling Methods ---
+    void trackCulling(int visible, int culled, double ms) {
+        visibleInstances += visible;
+        culledInstances += culled;
+        cullTime += ms;
+    }
+
+    void trackOcclusion(int occluded, int triangles, double raster_ms, double test_ms) {
+        occludedInstances += occluded;
+        occluderTriangles += triangles;
+        rasterTime += raster_ms;
+        occlusionTestTime += test_ms;
+    }
+
+    void trackLods(int mesh, int impostor) {
+        lodInstances[0] += mesh;
+        lodInstances[1] += impostor;
+    }
+
+    void trackSort(double ms) { sortTime += ms; }
+    void trackRenderQueue(long long packets, double sort_ms) {
+        renderPackets += packets;
+        queueSortTime += sort_ms;
+    }
+    void trackOverdraw(double samples_per_pixel) { overdraw = samples_per_pixel; }
+    void trackUniformUpdates(long long updates) { uniformUpdates = updates; }
+    void trackShaderVariant(long long key, double build_ms) {
+        shaderVariant = key;
+        variantBuildTime = build_ms;
+    }
+    void trackGpuTime(double ms, bool deferred_path) {
+        gpuTime = ms;
+        deferred = deferred_path;
+    }
+
+    void trackLightClusters(int lights, long long assignments, double ms) {
+        lightCount = lights;
+        lightAssignments = assignments;
+        lightCullTime = ms;
+    }
+
+    // --- Startup Methods ---
+    void trackStartup(double total_ms, double scene_ms, double shader_ms, int cache_hits, int programs) {
+        startupTime = total_ms;
+        sceneGenTime = scene_ms;
+        shaderTime = shader_ms;
+        shaderCacheHits = cache_hits;
+        shaderPrograms = programs;
+        // warm: every program came from the binary cache
+        const char *start = cache_hits == 0 ? "cold" : (cache_hits == programs ? "warm" : "partly warm");
+        std::cout << "[Startup] " << startupTime << "ms, " << start << " (scene generation " << sceneGenTime
+                  << "ms, shaders " << shaderTime << "ms, " << shaderCacheHits << "/" << shaderPrograms << " cached)" << std::endl;
+    }
+
+    // --- Thread Pool Methods ---
+    void trackWorkerTimes(const std::vector<double> &times) { workerTimes = times; }
 
     void printStats() {
         // Convert memory to MB for readability
@@ -132,10 +321,28 @@ public:
               << " (Min: " << minFrame << "ms, Max: " << maxFrame << "ms, Avg: " << avgFrame << "ms)" 
               << " | CPU: " << cpuRenderTime << "ms"
               << " | GPU Wait: " << gpuWaitTime << "ms"
+              << " | GPU: " << gpuTime << "ms" << (deferred ? " (deferred)" : " (forward)")
               << " | Calls: " << drawCalls
+              << " | State: " << stateChanges << " (" << stateElided << " elided)"
+              << " | Uniforms: " << uniformUpdates
+              << " | Variant: " << shaderVariant
               << " | Tris: " << (trisThisFrame / 1000) << "k"
               << " | VRAM: " << vramMB << "MB"
-              << " | Upload: " << uploadKB << "KB"
-              << std::endl;
+              << " | Scene: " << sceneMemory / (1024.0 * 1024.0) << "MB (peak " << peakSceneMemory / (1024.0 * 1024.0) << "MB)"
+              << " | Upload: " << uploadKB << "KB (" << instanceSize << "B/instance)"
+              << " | Fence: " << fenceWaitTime << "ms"
+              << " | Visible: " << visibleInstances << " (culled " << culledInstances << ", " << cullTime << "ms)"
+              << " | Occluded: " << occludedInstances << " (" << occluderTriangles << " tris, raster " << rasterTime << "ms, test " << occlusionTestTime << "ms)"
+              << " | LOD: " << lodInstances[0] << " / " << lodInstances[1]
+              << " | Sort: " << sortTime << "ms, overdraw " << overdraw
+              << " | Queue: " << renderPackets << " packets (" << queueSortTime << "ms)"
+              << " | Lights: " << lightCount << " (" << lightAssignments << " binned, " << lightCullTime << "ms)";
+        if (!workerTimes.empty()) {
+            std::cout << " | Workers:";
+            for (double t : workerTimes) {
+                std::cout << " " << t << "ms";
+            }
+        }
+        std::cout << std::endl;
     }
 };
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "programCache.h"
+#include "glExtensions.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#define PROGRAM_CACHE_MAGIC 0x42504c47u    // "GLPB"
+#define PROGRAM_CACHE_VERSION 1u
+#define PROGRAM_CACHE_MAX_BYTES (64u << 20)     // no program binary is anywhere near this
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+static void fnv1a(uint64_t &h, const void *data, size_t n){
+    const unsigned char *p = (const unsigned char*)data;
+    for(size_t i = 0; i < n; i++){
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+}
+
+static void fnv1a(uint64_t &h, const std::string &s){
+    // the terminator too, so "ab" + "c" and "a" + "bc" differ
+    fnv1a(h, s.c_str(), s.size() + 1);
+}
+
+uint64_t program_key(const std::string &vertex, const std::string &fragment, const std::string &defines){
+    uint64_t h = 0xcbf29ce484222325ull;
+    fnv1a(h, vertex);
+    fnv1a(h, fragment);
+    fnv1a(h, defines);
+    const GLenum driver[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for(GLenum name : driver){
+        const char *s = (const char*)glGetString(name);
+        fnv1a(h, s ? std::string(s) : std::string());
+    }
+    return h;
+}
+
+static std::string cache_path(uint64_t key){
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return std::string(PROGRAM_CACHE_DIR) + "/" + name;
+}
+
+bool load_program_binary(GLuint program, uint64_t key){
+    if(!glext.program_binary){
+        return false;
+    }
+    std::ifstream file(cache_path(key), std::ios::binary);
+    if(!file){
+        return false;
+    }
+    ProgramCacheHeader header;
+    if(!file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC
+       || header.version != PROGRAM_CACHE_VERSION || header.key != key){
+        return false;
+    }
+    // the length must be exactly what follows the header, so a corrupt or
+    // truncated entry falls back to compiling instead of a huge allocation
+    std::streamoff body = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - body;
+    if(header.length == 0 || header.length > PROGRAM_CACHE_MAX_BYTES || remaining != (std::streamoff)header.length){
+        std::cout << "[ProgramCache] ignoring corrupt " << cache_path(key) << std::endl;
+        return false;
+    }
+    file.seekg(body);
+    std::vector<char> binary(header.length);
+    if(!file.read(binary.data(), binary.size())){
+        return false;
+    }
+
+    glext.ProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked != 0;
+}
+
+void save_program_binary(GLuint program, uint64_t key){
+    if(!glext.program_binary){
+        return;
+    }
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0){
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glext.GetProgramBinary(program, length, &length, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(PROGRAM_CACHE_DIR, error);
+    std::ofstream file(cache_path(key), std::ios::binary | std::ios::trunc);
+    if(!file){
+        std::cout << "[ProgramCache] cannot write " << cache_path(key) << std::endl;
+        return;
+    }
+    ProgramCacheHeader header = {PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, format, (uint32_t)length};
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), length);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+
+#define PROGRAM_CACHE_DIR "shader_cache"
+
+/*
+ * On-disk cache of linked program binaries (ARB_get_program_binary), so a
+ * warm start skips compiling and linking GLSL. Entries are keyed by a hash
+ * of everything that affects the binary: the sources, the defines injected
+ * into them and the driver (vendor, renderer, version); a different driver
+ * or an edited shader simply misses and recompiles.
+ */
+
+// 64-bit FNV-1a of the sources and the driver strings (needs a current context)
+uint64_t program_key(const std::string &vertex, const std::string &fragment, const std::string &defines = "");
+
+// Loads the cached binary for key into program; false (program not linked) if there is none or the driver rejects it
+bool load_program_binary(GLuint program, uint64_t key);
+
+// Writes the binary of a linked program, created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT, under key
+void save_program_binary(GLuint program, uint64_t key);
@@ -0,0 +1,127 @@
+#include "radixSort.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MIN_BLOCK 16384   // below this a block is not worth a task
+
+template <typename Key>
+static void radix_sort(Key *keys, uint32_t *values, size_t n, Key *keys_tmp, uint32_t *values_tmp,
+                       std::vector<size_t> &hist, ThreadPool &pool){
+    if(n < 2){
+        return;
+    }
+    size_t blocks = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, n / RADIX_MIN_BLOCK));
+    size_t block = (n + blocks - 1) / blocks;
+    blocks = (n + block - 1) / block;
+
+    hist.resize(blocks * RADIX_BUCKETS);
+    Key *src_k = keys, *dst_k = keys_tmp;
+    uint32_t *src_v = values, *dst_v = values_tmp;
+
+    for(int shift = 0; shift < 8 * (int)sizeof(Key); shift += RADIX_BITS){
+        std::fill(hist.begin(), hist.end(), 0);
+        pool.parallel_for(0, blocks, 1, 1, [&](size_t b, size_t e, unsigned){
+            for(size_t blk = b; blk < e; blk++){
+                size_t *h = &hist[blk * RADIX_BUCKETS];
+                for(size_t i = blk * block, end = std::min(n, i + block); i < end; i++){
+                    h[(src_k[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                }
+            }
+        });
+
+        // every key has the same digit: the pass would only copy
+        bool trivial = false;
+        for(size_t d = 0; d < RADIX_BUCKETS && !trivial; d++){
+            size_t total = 0;
+            for(size_t blk = 0; blk < blocks; blk++){
+                total += hist[blk * RADIX_BUCKETS + d];
+            }
+            trivial = total == n;
+        }
+        if(trivial){
+            continue;
+        }
+
+        // digit-major, block-minor exclusive scan keeps the sort stable
+        size_t sum = 0;
+        for(size_t d = 0; d < RADIX_BUCKETS; d++){
+            for(size_t blk = 0; blk < blocks; blk++){
+                size_t c = hist[blk * RADIX_BUCKETS + d];
+                hist[blk * RADIX_BUCKETS + d] = sum;
+                sum += c;
+            }
+        }
+
+        pool.parallel_for(0, blocks, 1, 1, [&](size_t b, size_t e, unsigned){
+            for(size_t blk = b; blk < e; blk++){
+                size_t *offset = &hist[blk * RADIX_BUCKETS];
+                for(size_t i = blk * block, end = std::min(n, i + block); i < end; i++){
+                    size_t o = offset[(src_k[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                    dst_k[o] = src_k[i];
+                    dst_v[o] = src_v[i];
+                }
+            }
+        });
+        std::swap(src_k, dst_k);
+        std::swap(src_v, dst_v);
+    }
+
+    if(src_k != keys){
+        std::copy(src_k, src_k + n, keys);
+        std::copy(src_v, src_v + n, values);
+    }
+}
+
+void radix_sort_pairs(uint32_t *keys, uint32_t *values, size_t n,
+                      uint32_t *keys_tmp, uint32_t *values_tmp, std::vector<size_t> &hist, ThreadPool &pool){
+    radix_sort(keys, values, n, keys_tmp, values_tmp, hist, pool);
+}
+
+void radix_sort_pairs(uint64_t *keys, uint32_t *values, size_t n,
+                      uint64_t *keys_tmp, uint32_t *values_tmp, std::vector<size_t> &hist, ThreadPool &pool){
+    radix_sort(keys, values, n, keys_tmp, values_tmp, hist, pool);
+}
+
+template <typename Key>
+static size_t check_radix_sort(size_t n, int key_bits, ThreadPool &pool){
+    std::vector<Key> keys(n), keys_tmp(n), expected_keys(n);
+    std::vector<uint32_t> values(n), values_tmp(n), expected(n);
+    std::vector<size_t> hist;
+    // splitmix64, masked to a few digits in the low and high bytes, so
+    // equal keys are common and some passes are trivial
+    uint64_t state = 1;
+    Key mask = (Key)0xF0F0u | (Key)0xF0u << (key_bits - 8);
+    for(size_t i = 0; i < n; i++){
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        keys[i] = (Key)(z ^ (z >> 31)) & mask;
+        values[i] = (uint32_t)i;
+    }
+    std::iota(expected.begin(), expected.end(), 0u);
+    std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b){ return keys[a] < keys[b]; });
+    for(size_t i = 0; i < n; i++){
+        expected_keys[i] = keys[expected[i]];
+    }
+
+    radix_sort(keys.data(), values.data(), n, keys_tmp.data(), values_tmp.data(), hist, pool);
+    size_t wrong = 0;
+    for(size_t i = 0; i < n; i++){
+        wrong += keys[i] != expected_keys[i] || values[i] != expected[i];
+    }
+    return wrong;
+}
+
+size_t check_radix_sort(size_t n, ThreadPool &pool){
+    size_t wrong32 = check_radix_sort<uint32_t>(n, 32, pool);
+    size_t wrong64 = check_radix_sort<uint64_t>(n, 64, pool);
+    std::cout << "[RadixSort] " << n << " pairs vs std::stable_sort: " << wrong32 << " misplaced (32-bit keys), "
+              << wrong64 << " (64-bit keys)" << std::endl;
+    return wrong32 + wrong64;
+}
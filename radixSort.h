@@ -0,0 +1,31 @@
+#pragma once
+
+#include "threadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Stable LSD radix sort of (key, value) pairs on 32-bit keys, 8 bits per pass.
+ *
+ * The range is cut into a fixed number of blocks so every pass is:
+ * per-block digit histograms (parallel), one exclusive scan over
+ * digit-major/block-minor counts, then a stable scatter where each block
+ * writes from its own offsets (parallel). Passes whose digit is the same
+ * for every key are skipped.
+ *
+ * keys_tmp and values_tmp must hold n elements; the sorted pairs always end
+ * up back in keys/values. hist is scratch for the block histograms, resized
+ * as needed: a caller that keeps it across calls only allocates when it grows.
+ */
+void radix_sort_pairs(uint32_t *keys, uint32_t *values, size_t n,
+                      uint32_t *keys_tmp, uint32_t *values_tmp, std::vector<size_t> &hist, ThreadPool &pool);
+// Same on 64-bit keys, up to 8 passes
+void radix_sort_pairs(uint64_t *keys, uint32_t *values, size_t n,
+                      uint64_t *keys_tmp, uint32_t *values_tmp, std::vector<size_t> &hist, ThreadPool &pool);
+
+// Sorts n pseudo-random pairs (few distinct keys, so stability matters) with
+// both key widths and compares with std::stable_sort; prints and returns the
+// number of misplaced pairs
+size_t check_radix_sort(size_t n, ThreadPool &pool);
@@ -0,0 +1,118 @@
+#include "renderQueue.h"
+#include "radixSort.h"
+#include "glState.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+void RenderQueue::reset(){
+    programs.clear();
+    materials.clear();
+    packets.clear();
+    keys.clear();
+    models = nullptr;
+    normals = nullptr;
+    materials.push_back(RenderMaterial());
+}
+
+uint16_t RenderQueue::add_program(RenderProgram program){
+    programs.push_back(std::move(program));
+    return (uint16_t)(programs.size() - 1);
+}
+
+uint16_t RenderQueue::add_material(const RenderMaterial &material){
+    materials.push_back(material);
+    return (uint16_t)(materials.size() - 1);
+}
+
+void RenderQueue::set_transforms(const glm::mat4 *m, const glm::mat3 *n){
+    models = m;
+    normals = n;
+}
+
+void RenderQueue::submit(RenderPass pass, const RenderPacket &packet, float depth){
+    const uint64_t depth_max = (1ull << RENDER_DEPTH_BITS) - 1;
+    uint64_t d = (uint64_t)(std::min(std::max(depth, 0.f), 1.f) * depth_max);
+    if(pass == RenderPass::TRANSPARENT){
+        d = depth_max - d;
+    }
+    // the VAO field holds the low bits of the name: a collision only costs grouping
+    uint64_t key = (uint64_t)pass;
+    key = key << RENDER_PROGRAM_BITS | (packet.program & ((1u << RENDER_PROGRAM_BITS) - 1));
+    key = key << RENDER_MATERIAL_BITS | (packet.material & ((1u << RENDER_MATERIAL_BITS) - 1));
+    key = key << RENDER_VAO_BITS | (packet.vao & ((1u << RENDER_VAO_BITS) - 1));
+    key = key << RENDER_DEPTH_BITS | d;
+
+    packets.push_back(packet);
+    keys.push_back(key);
+}
+
+void RenderQueue::bind_material(const RenderMaterial &m, Shader &s, PerfTracker &tracker){
+    for(int b = 0; b < m.binding_count; b++){
+        const RenderMaterial::Binding &t = m.bindings[b];
+        tracker.countTextureBind(glstate.bind_texture(t.unit, t.target, t.texture));
+        glstate.bind_sampler(t.unit, t.sampler);
+    }
+    for(int u = 0; u < m.sampler_count; u++){
+        s.set(m.samplers[u], m.sampler_units[u]);
+    }
+}
+
+void RenderQueue::execute(ThreadPool &pool, PerfTracker &tracker){
+    size_t n = packets.size();
+    auto start = std::chrono::high_resolution_clock::now();
+    order.resize(n);
+    std::iota(order.begin(), order.end(), 0u);
+    keys_tmp.resize(n);
+    order_tmp.resize(n);
+    radix_sort_pairs(keys.data(), order.data(), n, keys_tmp.data(), order_tmp.data(), sort_hist, pool);
+    sort_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    int program = -1, material = -1;
+    for(size_t k = 0; k < n; k++){
+        const RenderPacket &p = packets[order[k]];
+        RenderProgram &prog = programs[p.program];
+        if(p.program != program){
+            tracker.countShaderBind(prog.shader -> use());
+            if(prog.setup){
+                prog.setup(*prog.shader);
+            }
+            program = p.program;
+            // the material's sampler uniforms belong to the previous program
+            material = -1;
+        }
+        if(p.material != material){
+            bind_material(materials[p.material], *prog.shader, tracker);
+            material = p.material;
+        }
+        glstate.bind_vertex_array(p.vao);
+        if(p.transform != RENDER_NO_TRANSFORM){
+            if(prog.model.location >= 0){
+                prog.shader -> set(prog.model, models[p.transform]);
+            }
+            if(prog.normal_matrix.location >= 0 && normals){
+                prog.shader -> set(prog.normal_matrix, normals[p.transform]);
+            }
+        }
+
+        tracker.countDrawCall();
+        if(p.primitive == GL_POINTS){
+            if(p.instances){
+                glDrawArraysInstanced(GL_POINTS, 0, p.count, p.instances);
+            }
+            else{
+                glDrawArrays(GL_POINTS, 0, p.count);
+            }
+            continue;
+        }
+        tracker.countTriangles(p.count / 3 * std::max(1u, p.instances));
+        if(p.instances){
+            glDrawElementsInstanced(p.primitive, p.count, GL_UNSIGNED_INT, 0, p.instances);
+        }
+        else{
+            glDrawElements(p.primitive, p.count, GL_UNSIGNED_INT, 0);
+        }
+    }
+    tracker.trackRenderQueue(n, sort_ms);
+}
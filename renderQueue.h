@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "threadPool.h"
+#include "perfTracker.h"
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+// Sort key fields, most significant first: pass | program | material | VAO | depth.
+// Sorting by key runs every program's packets back to back, and inside them
+// every material's, so each state is bound once per frame
+#define RENDER_PASS_BITS 4
+#define RENDER_PROGRAM_BITS 12
+#define RENDER_MATERIAL_BITS 12
+#define RENDER_VAO_BITS 12
+#define RENDER_DEPTH_BITS 24
+
+#define RENDER_MAX_TEXTURES 8
+#define RENDER_NO_TRANSFORM 0xFFFFFFFFu
+
+enum class RenderPass {
+    OPAQUE,         // depth ascending: front to back
+    TRANSPARENT     // depth descending: back to front
+};
+
+// A program and the uniforms execute() sets on it
+struct RenderProgram {
+    Shader *shader = nullptr;
+    // per draw, from the packet's transform index (location -1: not set)
+    Uniform<glm::mat4> model;
+    Uniform<glm::mat3> normal_matrix;
+    // per frame uniforms, set once the program is bound; may be empty
+    std::function<void(Shader&)> setup;
+};
+
+// The textures a draw samples, and the sampler uniforms pointing at them
+struct RenderMaterial {
+    struct Binding {
+        int unit;
+        GLenum target;
+        GLuint texture;
+        GLuint sampler;
+    };
+    Binding bindings[RENDER_MAX_TEXTURES];
+    int binding_count = 0;
+    // uniforms of the program the material is used with, set to their unit
+    Uniform<int> samplers[RENDER_MAX_TEXTURES];
+    int sampler_units[RENDER_MAX_TEXTURES];
+    int sampler_count = 0;
+
+    void add_texture(int unit, GLenum target, GLuint texture, GLuint sampler = 0){
+        bindings[binding_count++] = {unit, target, texture, sampler};
+    }
+    void add_sampler(Uniform<int> u, int unit){
+        samplers[sampler_count] = u;
+        sampler_units[sampler_count++] = unit;
+    }
+};
+
+// One draw: GL_TRIANGLES packets are indexed (unsigned int), GL_POINTS ones are not
+struct RenderPacket {
+    uint32_t vao;
+    uint32_t count;         // indices or vertices
+    uint32_t instances;     // 0: not instanced
+    uint32_t transform;     // index into the transform arrays, RENDER_NO_TRANSFORM if none
+    uint16_t program;
+    uint16_t material;
+    uint16_t primitive;
+};
+
+/**
+ * Per frame list of draws. Programs and materials are registered first, then
+ * every draw is submitted as a packet with its sort key; execute() radix
+ * sorts the keys and issues the draws, changing program, material and VAO
+ * only where the sorted sequence does. The tables keep their storage across
+ * frames, so a frame allocates nothing once they are large enough.
+ */
+class RenderQueue {
+public:
+    // Clears the tables, material 0 is always "no textures"
+    void reset();
+
+    uint16_t add_program(RenderProgram program);
+    uint16_t add_material(const RenderMaterial &material);
+    // Model matrices and normal matrices indexed by RenderPacket::transform, valid until execute()
+    void set_transforms(const glm::mat4 *models, const glm::mat3 *normals);
+
+    // depth in [0, 1], 0 nearest
+    void submit(RenderPass pass, const RenderPacket &packet, float depth = 0.f);
+
+    void execute(ThreadPool &pool, PerfTracker &tracker);
+
+    size_t size() const { return packets.size(); }
+    double sort_ms = 0.0;
+
+private:
+    std::vector<RenderProgram> programs;
+    std::vector<RenderMaterial> materials;
+    std::vector<RenderPacket> packets;
+    std::vector<uint64_t> keys, keys_tmp;
+    std::vector<uint32_t> order, order_tmp;
+    std::vector<size_t> sort_hist;
+    const glm::mat4 *models = nullptr;
+    const glm::mat3 *normals = nullptr;
+
+    void bind_material(const RenderMaterial &m, Shader &s, PerfTracker &tracker);
+};
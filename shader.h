@@ -3,26 +3,58 @@
 #include <glad/glad.h>
 
 #include <string>
+#include <unordered_map>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
 
+#include "programCache.h"
+#include "glExtensions.h"
+#include "glState.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// Declaration of the Frame uniform block (FrameBlock in main.h), shared by
+// every program
+#define FRAME_BLOCK_PATH "shaders/frame_block.glsl"
+
+// Location of an active uniform, resolved once after linking. T is the C++
+// type it is set with, so the setters need neither a lookup nor a string
+template <typename T>
+struct Uniform {
+    GLint location = -1;
+};
+
 class Shader{
 public:
     // the program ID
     unsigned int ID;
 
+    // glUniform* calls issued through any Shader since the last reset
+    inline static long long uniform_updates = 0;
+
+    // Programs loaded from / missing in the binary cache, and the time spent
+    // building all of them (reading sources excluded)
+    inline static int cache_hits = 0;
+    inline static int cache_misses = 0;
+    inline static double build_ms = 0.0;
+
     Shader(){
         
     }
 
     // constuctor reads and builds the shader
-    Shader(const char* vertexpath, const char* fragmentPath){
+    Shader(const char* vertexpath, const char* fragmentPath) : Shader(vertexpath, fragmentPath, ""){
+    }
+
+    // same, with `defines` (#define lines) inserted right after the #version
+    // line of both sources, so one file can be built specialized several ways.
+    // The Frame block declaration (FRAME_BLOCK_PATH) follows them in every source
+    Shader(const char* vertexpath, const char* fragmentPath, const std::string &defines){
         //1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -50,6 +82,135 @@ public:
         catch(std::ifstream::failure e){
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
         }
+        inject(vertexCode, defines);
+        inject(fragmentCode, defines);
+        auto build_start = std::chrono::high_resolution_clock::now();
+
+        // a cached binary skips compiling and linking altogether
+        uint64_t key = program_key(vertexCode, fragmentCode, defines);
+        ID = glCreateProgram();
+        if(load_program_binary(ID, key)){
+            cache_hits++;
+        }
+        else{
+            // a rejected binary leaves the program unusable, start over
+            glDeleteProgram(ID);
+            ID = glCreateProgram();
+            cache_misses++;
+            compile(vertexCode, fragmentCode, key);
+        }
+        build_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+        reflect();
+    }
+
+    // false when the program was already in use (see glState.h)
+    bool use(){
+        return glstate.use_program(ID);
+    }
+
+    // Handle of the uniform `name`, location -1 (setting it is a no-op) if the
+    // program has no such active uniform or it does not hold a T
+    template <typename T>
+    Uniform<T> uniform(const std::string &name) const {
+        Uniform<T> u;
+        auto it = uniforms.find(name);
+        if(it == uniforms.end()){
+            return u;
+        }
+        if(!holds(it->second.type, (T*)nullptr)){
+            std::cout << "[Shader] uniform " << name << " has GL type 0x" << std::hex << it->second.type << std::dec
+                      << ", not the one it is set with" << std::endl;
+            return u;
+        }
+        u.location = it->second.location;
+        return u;
+    }
+
+    // handle setters, for the uniforms of the program in use
+    void set(Uniform<bool> u, bool value) const {
+        if(u.location >= 0){ glUniform1i(u.location, (int)value); uniform_updates++; }
+    }
+    void set(Uniform<int> u, int value) const {
+        if(u.location >= 0){ glUniform1i(u.location, value); uniform_updates++; }
+    }
+    void set(Uniform<float> u, float value) const {
+        if(u.location >= 0){ glUniform1f(u.location, value); uniform_updates++; }
+    }
+    void set(Uniform<glm::vec3> u, const glm::vec3 &vec) const {
+        if(u.location >= 0){ glUniform3fv(u.location, 1, glm::value_ptr(vec)); uniform_updates++; }
+    }
+    void set(Uniform<glm::ivec3> u, const glm::ivec3 &vec) const {
+        if(u.location >= 0){ glUniform3iv(u.location, 1, glm::value_ptr(vec)); uniform_updates++; }
+    }
+    void set(Uniform<glm::vec4> u, const glm::vec4 &vec) const {
+        if(u.location >= 0){ glUniform4fv(u.location, 1, glm::value_ptr(vec)); uniform_updates++; }
+    }
+    void set(Uniform<glm::mat3> u, const glm::mat3 &mat) const {
+        if(u.location >= 0){ glUniformMatrix3fv(u.location, 1, GL_FALSE, glm::value_ptr(mat)); uniform_updates++; }
+    }
+    void set(Uniform<glm::mat4> u, const glm::mat4 &mat) const {
+        if(u.location >= 0){ glUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(mat)); uniform_updates++; }
+    }
+
+    // Points the uniform block `name` at a GL_UNIFORM_BUFFER binding point,
+    // nothing if the program does not use it
+    void bind_block(const char *name, GLuint binding) const {
+        GLuint index = glGetUniformBlockIndex(ID, name);
+        if(index != GL_INVALID_INDEX){
+            glUniformBlockBinding(ID, index, binding);
+        }
+    }
+
+    // by name, through the table filled at link time (no glGetUniformLocation)
+    void setBool(const std::string &name, bool value) const
+    {         
+        set(Uniform<bool>{location(name)}, value);
+    }
+    void setInt(const std::string &name, int value) const
+    { 
+        set(Uniform<int>{location(name)}, value);
+    }
+    void setFloat(const std::string &name, float value) const
+    { 
+        set(Uniform<float>{location(name)}, value);
+    } 
+    void setMatrix(const std::string &name, const glm::mat4 &mat) const {
+        set(Uniform<glm::mat4>{location(name)}, mat);
+    }
+    void setVector3(const std::string &name, const glm::vec3 &vec) const {
+        set(Uniform<glm::vec3>{location(name)}, vec);
+    }
+
+private:
+    static void inject(std::string &code, const std::string &defines){
+        size_t line = code.find('\n');
+        line = line == std::string::npos ? code.size() : line + 1;
+        // #line keeps the compiler's line numbers those of the file
+        code.insert(line, defines + frame_block() + "#line 2\n");
+    }
+
+    // FRAME_BLOCK_PATH, read on first use
+    static const std::string &frame_block(){
+        static const std::string code = [](){
+            std::ifstream file(FRAME_BLOCK_PATH);
+            if(!file){
+                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ " << FRAME_BLOCK_PATH << std::endl;
+                return std::string();
+            }
+            std::stringstream stream;
+            stream << file.rdbuf();
+            std::string text = stream.str();
+            if(!text.empty() && text.back() != '\n'){
+                text += '\n';
+            }
+            return text;
+        }();
+        return code;
+    }
+
+    // Compiles and links the sources into ID, then stores the binary under key
+    void compile(const std::string &vertexCode, const std::string &fragmentCode, uint64_t key){
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
 
@@ -80,7 +241,9 @@ public:
         }
 
         // Shader Program
-        ID = glCreateProgram();
+        if(glext.program_binary){
+            glext.ProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         glLinkProgram(ID);
@@ -90,34 +253,65 @@ public:
             glGetProgramInfoLog(ID, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
+        else{
+            save_program_binary(ID, key);
+        }
 
         // delete the shaders
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-
     }
 
-    void use(){
-        glUseProgram(ID);
-    }
+    struct Active {
+        GLint location;
+        GLenum type;
+    };
+    // every active uniform by name; arrays also have one entry per element
+    std::unordered_map<std::string, Active> uniforms;
 
-    void setBool(const std::string &name, bool value) const
-    {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+    GLint location(const std::string &name) const {
+        auto it = uniforms.find(name);
+        return it == uniforms.end() ? -1 : it->second.location;
     }
-    void setInt(const std::string &name, int value) const
-    { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
-    }
-    void setFloat(const std::string &name, float value) const
-    { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
-    } 
-    void setMatrix(const std::string &name, glm::mat4 &mat){
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+
+    void reflect(){
+        GLint count = 0, max_length = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+        std::string name(std::max(max_length, 1), '\0');
+        for(GLint i = 0; i < count; i++){
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+            std::string n = name.substr(0, length);
+            GLint loc = glGetUniformLocation(ID, n.c_str());
+            if(loc < 0){
+                continue;  // block member, set through its buffer
+            }
+            uniforms[n] = {loc, type};
+            // "a[0]" of a basic type array stands for the whole array: add "a" and "a[k]"
+            if(n.size() > 3 && n.compare(n.size() - 3, 3, "[0]") == 0){
+                std::string base = n.substr(0, n.size() - 3);
+                uniforms[base] = {loc, type};
+                for(GLint k = 1; k < size; k++){
+                    std::string element = base + "[" + std::to_string(k) + "]";
+                    uniforms[element] = {glGetUniformLocation(ID, element.c_str()), type};
+                }
+            }
+        }
     }
-    void setVector3(const std::string &name, glm::vec3 &vec){
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(vec));
+
+    static bool holds(GLenum type, bool*) { return type == GL_BOOL || type == GL_INT; }
+    static bool holds(GLenum type, int*) {
+        return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_BUFFER
+            || type == GL_UNSIGNED_INT_SAMPLER_BUFFER;
     }
+    static bool holds(GLenum type, float*) { return type == GL_FLOAT; }
+    static bool holds(GLenum type, glm::vec3*) { return type == GL_FLOAT_VEC3; }
+    static bool holds(GLenum type, glm::ivec3*) { return type == GL_INT_VEC3; }
+    static bool holds(GLenum type, glm::vec4*) { return type == GL_FLOAT_VEC4; }
+    static bool holds(GLenum type, glm::mat3*) { return type == GL_FLOAT_MAT3; }
+    static bool holds(GLenum type, glm::mat4*) { return type == GL_FLOAT_MAT4; }
 
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "shader.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+// Lighting models of fragment.glsl (LIGHTING_MODEL)
+#define LIGHTING_LAMBERT 0      // diffuse only
+#define LIGHTING_PHONG 1
+#define LIGHTING_BLINN_PHONG 2
+
+// NUM_LIGHTS of the generic program: the count comes from uniforms at run time
+#define DYNAMIC_LIGHTS -1
+// Up to this many point lights a variant with the exact count baked in is used
+#define MAX_UNROLLED_LIGHTS 8
+
+// The compile-time specialization of a program, injected as #defines
+struct ShaderDefines {
+    int lights = DYNAMIC_LIGHTS;
+    bool specular_map = true;
+    int lighting_model = LIGHTING_PHONG;
+    bool cpu_normals = true;    // normal matrix from the CPU instead of inverse() per vertex
+
+    uint32_t key() const {
+        return (uint32_t)(lights + 1) | (uint32_t)specular_map << 16 | (uint32_t)lighting_model << 17
+               | (uint32_t)cpu_normals << 19;
+    }
+
+    std::string source() const {
+        return "#define NUM_LIGHTS " + std::to_string(lights) + "\n"
+               "#define SPECULAR_MAP " + std::to_string((int)specular_map) + "\n"
+               "#define LIGHTING_MODEL " + std::to_string(lighting_model) + "\n"
+               "#define CPU_NORMAL_MATRIX " + std::to_string((int)cpu_normals) + "\n";
+    }
+
+    std::string name() const {
+        const char *models[] = {"lambert", "phong", "blinn-phong"};
+        return (lights == DYNAMIC_LIGHTS ? std::string("dynamic lights") : std::to_string(lights) + " lights")
+               + (specular_map ? ", specular map, " : ", no specular map, ") + models[lighting_model]
+               + (cpu_normals ? "" : ", GPU normals");
+    }
+};
+
+/**
+ * The variants of one vertex/fragment pair, built the first time they are
+ * asked for and kept by key. Handles are the program's uniform handles, with
+ * a resolve(Shader&) that looks them up once the program is built. Every
+ * variant keeps its build time and the GPU time of the frames drawn with it,
+ * so the variants can be compared.
+ */
+template <typename Handles>
+class ShaderVariants {
+public:
+    struct Variant {
+        Shader shader;
+        Handles handles;
+        ShaderDefines defines;
+        double build_ms = 0.0;  // compile and link, or load from the binary cache
+        long long frames = 0;   // frames timed while it was in use
+        double gpu_ms = 0.0;    // their GPU time, summed
+
+        void time_frame(double ms){
+            frames++;
+            gpu_ms += ms;
+        }
+        double average_gpu_ms() const { return frames ? gpu_ms / frames : 0.0; }
+    };
+
+    ShaderVariants(){
+    }
+
+    ShaderVariants(const char *vertex, const char *fragment) : vertex_path(vertex), fragment_path(fragment){
+    }
+
+    Variant &get(const ShaderDefines &defines){
+        auto it = variants.find(defines.key());
+        if(it != variants.end()){
+            return it -> second;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        Variant &v = variants[defines.key()];
+        v.shader = Shader(vertex_path, fragment_path, defines.source());
+        v.handles.resolve(v.shader);
+        v.defines = defines;
+        v.build_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "[ShaderVariant] " << vertex_path << " + " << fragment_path << " (" << defines.name() << "): "
+                  << v.build_ms << "ms" << std::endl;
+        return v;
+    }
+
+    const std::unordered_map<uint32_t, Variant> &all() const { return variants; }
+
+private:
+    const char *vertex_path = nullptr;
+    const char *fragment_path = nullptr;
+    // elements of an unordered_map never move, so a Variant& stays valid
+    std::unordered_map<uint32_t, Variant> variants;
+};
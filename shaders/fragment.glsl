@@ -1,5 +1,19 @@
 #version 330 core
-#define MAX_LIGHTS 100
+
+// Specialization, injected by ShaderVariants (shaderVariants.h). The defaults
+// give the generic program
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS -1       // point lights baked in, -1: numLights or the clusters at run time
+#endif
+#ifndef SPECULAR_MAP
+#define SPECULAR_MAP 1      // 0: uniform specular, the map is not sampled
+#endif
+#ifndef LIGHTING_MODEL
+#define LIGHTING_MODEL 1    // 0 Lambert, 1 Phong, 2 Blinn-Phong
+#endif
+
+// constant trip counts, let the drivers that honour it unroll them
+#pragma optionNV(unroll all)
 
 out vec4 FragColor;
 
@@ -12,29 +26,72 @@ struct Material{
 uniform Material material;
 in vec2 TexCoords;
 
-struct DirectionalLight{
-    vec3 direction;
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
 
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-uniform DirectionalLight directionalLight;
-
-struct Light{
-    vec3 position;
-    
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-uniform Light lights[MAX_LIGHTS];
+// point lights, 4 texels each (PointLight in lightClusters.h): position and radius, ambient, diffuse, specular
+uniform samplerBuffer lightData;
 uniform int numLights;
+uniform float lightCutoff;      // attenuation at a light's radius, rescaled to 0 there by the clustered path
+
+// clustered forward shading: only the lights binned into this fragment's cluster
+uniform bool clustered;
+uniform usamplerBuffer clusterGrid;     // per cluster: first entry in clusterLights, light count
+uniform usamplerBuffer clusterLights;   // light indices
+uniform ivec3 clusterDims;
+uniform vec4 clusterScale;      // xy: clusters per pixel, depth slice = log(view depth) * z + w
 
-uniform vec3 viewPos;
 
 in vec3 Normal;
 in vec3 FragPos;
+
+const float ambientStrength = 0.2;
+const float specularStrength = 0.5;
+
+// specular factor for light direction lightDir
+float specularTerm(vec3 norm, vec3 viewDir, vec3 lightDir)
+{
+#if LIGHTING_MODEL == 2
+    return pow(max(dot(norm, normalize(lightDir + viewDir)), 0.0), 4.0 * 32.0);
+#elif LIGHTING_MODEL == 1
+    return pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32.0);
+#else
+    return 0.0;
+#endif
+}
+
+// attenuation is rescaled so that cutoff maps to 0; a cutoff of 0.0 leaves it unchanged
+void addPointLight(int i, float cutoff, vec3 norm, vec3 viewDir, vec3 diffuseVec, vec3 specularVec,
+                   inout vec3 ambient, inout vec3 diffuse, inout vec3 specular)
+{
+    vec3 lightPosition = texelFetch(lightData, 4 * i).xyz;
+    vec3 lightAmbient = texelFetch(lightData, 4 * i + 1).rgb;
+    vec3 lightDiffuse = texelFetch(lightData, 4 * i + 2).rgb;
+    vec3 lightSpecular = texelFetch(lightData, 4 * i + 3).rgb;
+
+    // Distance from fragment to light
+    float distance = length(lightPosition - FragPos);
+
+    // Attenuation
+    float attenuation = 1.0 / (1.0 +
+                            0.07 * distance +
+                            0.017 * (distance * distance));
+    attenuation = max(attenuation - cutoff, 0.0) / (1.0 - cutoff);
+
+    // Ambient (affected by attenuation)
+    vec3 ambientTerm = ambientStrength * lightAmbient * diffuseVec;
+
+    // Diffuse
+    vec3 lightDir = normalize(lightPosition - FragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuseTerm = diff * lightDiffuse * diffuseVec;
+
+    // Apply attenuation
+    ambient  += ambientTerm  * attenuation;
+    diffuse  += diffuseTerm  * attenuation;
+#if LIGHTING_MODEL != 0
+    specular += specularStrength * specularTerm(norm, viewDir, lightDir) * lightSpecular * specularVec * attenuation;
+#endif
+}
   
 void main()
 {
@@ -42,14 +99,16 @@ void main()
     vec3 diffuse = vec3(0.0);
     vec3 specular = vec3(0.0);
 
-    float ambientStrength = 0.2;
-    float specularStrength = 0.5;
-
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
 
     vec3 diffuseVec = vec3(texture(material.diffuse, TexCoords));
+#if SPECULAR_MAP
     vec3 specularVec = vec3(texture(material.specular, TexCoords));
+#else
+    // no map loaded: the unspecialized program sampled an incomplete texture, i.e. black
+    vec3 specularVec = vec3(0.0);
+#endif
 
 
     // -------- DIRECTIONAL LIGHT
@@ -57,37 +116,35 @@ void main()
 
     ambient += ambientStrength * directionalLight.ambient * diffuseVec;
     diffuse += max(dot(norm, ambientLightDirection), 0.0) * directionalLight.diffuse * diffuseVec;
-    specular += specularStrength * pow(max(dot(viewDir, reflect(-ambientLightDirection, norm)), 0.0), 32) * directionalLight.specular * specularVec;
-
-
-    for (int i = 0; i < numLights; i++) {
-        // Distance from fragment to light
-        float distance = length(lights[i].position - FragPos);
-        
-        // Attenuation
-        float attenuation = 1.0 / (1.0 +
-                                0.07 * distance +
-                                0.017 * (distance * distance));
-
-        // Ambient (affected by attenuation)
-        vec3 ambientTerm = ambientStrength * lights[i].ambient * diffuseVec;
-
-        // Diffuse
-        vec3 lightDir = normalize(lights[i].position - FragPos);
-        float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuseTerm = diff * lights[i].diffuse * diffuseVec;
-
-        // Specular
-        vec3 reflectDir = reflect(-lightDir, norm);
-        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-        vec3 specularTerm = specularStrength * spec * lights[i].specular * specularVec;
-
-        // Apply attenuation
-        ambient  += ambientTerm  * attenuation;
-        diffuse  += diffuseTerm  * attenuation;
-        specular += specularTerm * attenuation;
+#if LIGHTING_MODEL != 0
+    specular += specularStrength * specularTerm(norm, viewDir, ambientLightDirection) * directionalLight.specular * specularVec;
+#endif
+
+
+#if NUM_LIGHTS > 0
+    for (int i = 0; i < NUM_LIGHTS; i++) {
+        addPointLight(i, 0.0, norm, viewDir, diffuseVec, specularVec, ambient, diffuse, specular);
+    }
+#elif NUM_LIGHTS < 0
+    if (clustered) {
+        float depth = -(view * vec4(FragPos, 1.0)).z;
+        ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy * clusterScale.xy), int(floor(log(depth) * clusterScale.z + clusterScale.w)));
+        cluster = clamp(cluster, ivec3(0), clusterDims - 1);
+        uvec2 range = texelFetch(clusterGrid, (cluster.z * clusterDims.y + cluster.y) * clusterDims.x + cluster.x).rg;
+        for (uint k = 0u; k < range.y; k++) {
+            int i = int(texelFetch(clusterLights, int(range.x + k)).r);
+            // down to 0 at the radius the light was binned with
+            addPointLight(i, lightCutoff, norm, viewDir, diffuseVec, specularVec, ambient, diffuse, specular);
+        }
+    }
+    else {
+        // the reference: every light, attenuation unchanged
+        for (int i = 0; i < numLights; i++) {
+            addPointLight(i, 0.0, norm, viewDir, diffuseVec, specularVec, ambient, diffuse, specular);
+        }
     }
+#endif
 
     vec3 result = (ambient + diffuse + specular);
     FragColor = vec4(result, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,42 @@
+#version 330 core
+// Deferred lighting, first pass: the directional light (and ambient) of
+// every pixel in the G-buffer; unlit pixels are copied as they are
+out vec4 FragColor;
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 invViewProjection;
+
+const float ambientStrength = 0.2;
+const float specularStrength = 0.5;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+    vec4 normal = texelFetch(gNormal, pixel, 0);
+    if (normal.a == 0.0) {
+        FragColor = vec4(albedo.rgb, 1.0);
+        return;
+    }
+
+    // world position from the depth buffer
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 ndc = vec4(uv, texelFetch(gDepth, pixel, 0).r, 1.0) * 2.0 - 1.0;
+    vec4 world = invViewProjection * ndc;
+    vec3 FragPos = world.xyz / world.w;
+
+    vec3 norm = normal.xyz;
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 diffuseVec = albedo.rgb;
+    vec3 specularVec = vec3(albedo.a);
+
+    vec3 ambientLightDirection = normalize(-directionalLight.direction);
+    vec3 result = ambientStrength * directionalLight.ambient * diffuseVec;
+    result += max(dot(norm, ambientLightDirection), 0.0) * directionalLight.diffuse * diffuseVec;
+    result += specularStrength * pow(max(dot(viewDir, reflect(-ambientLightDirection, norm)), 0.0), 32) * directionalLight.specular * specularVec;
+    FragColor = vec4(result, 1.0);
+}
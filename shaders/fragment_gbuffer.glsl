@@ -0,0 +1,22 @@
+#version 330 core
+// Geometry pass of the deferred path: same inputs as fragment.glsl, no lighting
+layout (location = 0) out vec4 GAlbedo;     // albedo, a: specular map
+layout (location = 1) out vec4 GNormal;     // world normal, a: 1 = lit
+
+struct Material{
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+uniform Material material;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+void main()
+{
+    // the specular map is grey, one channel is enough
+    GAlbedo = vec4(texture(material.diffuse, TexCoords).rgb, texture(material.specular, TexCoords).r);
+    GNormal = vec4(normalize(Normal), 1.0);
+}
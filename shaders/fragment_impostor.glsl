@@ -0,0 +1,10 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 GNormal;     // deferred path only: a = 0 marks the pixel unlit
+
+flat in vec3 Color;
+
+void main(){
+    FragColor = vec4(Color, 1.0);
+    GNormal = vec4(0.0);
+}
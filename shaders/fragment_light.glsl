@@ -1,6 +1,8 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 GNormal;     // deferred path only: a = 0 marks the pixel unlit
 
 void main(){
     FragColor = vec4(1.0, 1.0, 1.0, 1.0);
+    GNormal = vec4(0.0);
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#version 330 core
+// Deferred lighting, point lights: added to the pixels of the G-buffer
+// inside the light's radius, same terms as the point lights of fragment.glsl
+out vec4 FragColor;
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+uniform samplerBuffer lightData;
+uniform float lightCutoff;      // attenuation at a light's radius, rescaled to 0 there
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 invViewProjection;
+
+flat in int Light;
+
+const float ambientStrength = 0.2;
+const float specularStrength = 0.5;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 normal = texelFetch(gNormal, pixel, 0);
+    if (normal.a == 0.0) {
+        discard;
+    }
+
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 ndc = vec4(uv, texelFetch(gDepth, pixel, 0).r, 1.0) * 2.0 - 1.0;
+    vec4 world = invViewProjection * ndc;
+    vec3 FragPos = world.xyz / world.w;
+
+    vec4 lightPosition = texelFetch(lightData, 4 * Light);
+    float distance = length(lightPosition.xyz - FragPos);
+    if (distance > lightPosition.w) {
+        discard;
+    }
+    vec3 lightAmbient = texelFetch(lightData, 4 * Light + 1).rgb;
+    vec3 lightDiffuse = texelFetch(lightData, 4 * Light + 2).rgb;
+    vec3 lightSpecular = texelFetch(lightData, 4 * Light + 3).rgb;
+
+    vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+    vec3 norm = normal.xyz;
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 diffuseVec = albedo.rgb;
+    vec3 specularVec = vec3(albedo.a);
+
+    float attenuation = 1.0 / (1.0 +
+                            0.07 * distance +
+                            0.017 * (distance * distance));
+    attenuation = max(attenuation - lightCutoff, 0.0) / (1.0 - lightCutoff);
+
+    vec3 lightDir = normalize(lightPosition.xyz - FragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+
+    vec3 result = ambientStrength * lightAmbient * diffuseVec
+                + diff * lightDiffuse * diffuseVec
+                + specularStrength * spec * lightSpecular * specularVec;
+    FragColor = vec4(result * attenuation, 1.0);
+}
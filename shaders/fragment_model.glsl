@@ -1,5 +1,6 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 GNormal;     // deferred path only: a = 0 marks the pixel unlit
 
 in vec2 TexCoords;
 
@@ -8,5 +9,6 @@ uniform sampler2D texture_diffuse1;
 void main()
 {    
     FragColor = texture(texture_diffuse1, TexCoords);
+    GNormal = vec4(0.0);
 }
 
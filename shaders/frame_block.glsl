@@ -0,0 +1,18 @@
+// Inserted by Shader (shader.h) after the #version line of every source, so
+// each program declares the block the same way.
+
+struct DirectionalLight{
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// per-frame camera and global lighting, one std140 buffer (FrameBlock in main.h) shared by every program
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    DirectionalLight directionalLight;
+};
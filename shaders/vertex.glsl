@@ -1,11 +1,17 @@
 #version 330 core
+
+// CPU_NORMAL_MATRIX (shaderVariants.h): 1 takes the normal matrix computed on
+// the CPU, 0 inverts the model matrix here, for every vertex
+#ifndef CPU_NORMAL_MATRIX
+#define CPU_NORMAL_MATRIX 1
+#endif
 layout (location = 0) in vec3 aPos;   // the position variable has attribute position 0
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
-uniform mat4 view;
-uniform mat4 projection;
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
 uniform mat4 model;
+uniform mat3 normalMatrix;  // transpose(inverse(mat3(model)))
 
 out vec3 Normal;
 out vec3 FragPos;
@@ -16,6 +22,10 @@ void main()
 {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     FragPos = vec3(model * vec4(aPos, 1.0));
+#if CPU_NORMAL_MATRIX
+    Normal = normalMatrix * aNormal;
+#else
     Normal = mat3(transpose(inverse(model))) *  aNormal;
+#endif
     TexCoords = aTexCoords;
 } 
\ No newline at end of file
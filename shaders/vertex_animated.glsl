@@ -0,0 +1,49 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per instance, uploaded once
+layout (location = 3) in vec3 aTranslation;
+layout (location = 4) in vec3 aScale;
+layout (location = 5) in vec3 aAxis;      // normalized
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+uniform float time;
+uniform float spread;
+uniform float rotSpeed;
+uniform bool orbit;     // light cubes also spin around the origin
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+// Same as glm::rotate: angle around a normalized axis
+mat3 rotation(vec3 axis, float angle)
+{
+    float c = cos(angle);
+    float s = sin(angle);
+    vec3 t = (1.0 - c) * axis;
+    return mat3(c + t.x * axis.x,          t.x * axis.y + s * axis.z, t.x * axis.z - s * axis.y,
+                t.y * axis.x - s * axis.z, c + t.y * axis.y,          t.y * axis.z + s * axis.x,
+                t.z * axis.x + s * axis.y, t.z * axis.y - s * axis.x, c + t.z * axis.z);
+}
+
+void main()
+{
+    mat3 R = rotation(aAxis, rotSpeed * time);
+
+    // scale(aScale) * translate(spread * aTranslation) * rotate(angle, aAxis)
+    vec3 world = aScale * (spread * aTranslation + R * aPos);
+    // the inverse transpose of scale * rotation is rotation divided by scale
+    vec3 normal = (R * aNormal) / aScale;
+    if (orbit) {
+        world = R * world;
+        normal = R * normal;
+    }
+
+    gl_Position = projection * view * vec4(world, 1.0);
+    FragPos = world;
+    Normal = normal;
+    TexCoords = aTexCoords;
+}
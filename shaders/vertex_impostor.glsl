@@ -0,0 +1,34 @@
+#version 330 core
+layout (location = 3) in mat4 aModel; // per instance, same matrices as the full cubes
+
+uniform float pixelScale;   // viewport height / 2 * projection[1][1]
+uniform vec3 albedo;        // average of the diffuse texture
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+flat out vec3 Color;
+
+void main()
+{
+    vec3 center = aModel[3].xyz;
+    vec4 eye = view * vec4(center, 1.0);
+    gl_Position = projection * eye;
+
+    // Flat shading of the whole cube: the directional light on the three
+    // faces turned to the camera, weighted by how much of each one is seen
+    mat3 normalMatrix = transpose(inverse(mat3(aModel)));
+    vec3 viewDir = normalize(viewPos - center);
+    vec3 lightDir = normalize(-directionalLight.direction);
+    float lit = 0.0, seen = 0.0;
+    for(int a = 0; a < 3; a++){
+        vec3 n = normalize(normalMatrix[a]);
+        float facing = dot(n, viewDir);
+        lit += abs(facing) * max(dot(n * sign(facing), lightDir), 0.0);
+        seen += abs(facing);
+    }
+    Color = albedo * (0.2 * directionalLight.ambient + directionalLight.diffuse * lit / max(seen, 1e-4));
+
+    // about as wide as the cube's silhouette
+    float edge = (length(aModel[0].xyz) + length(aModel[1].xyz) + length(aModel[2].xyz)) / 3.0;
+    gl_PointSize = max(1.0, 1.2 * edge * pixelScale / -eye.z);
+}
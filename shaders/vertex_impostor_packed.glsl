@@ -0,0 +1,43 @@
+#version 330 core
+// per instance, same packed data as the full cubes (see vertex_packed.glsl)
+layout (location = 3) in vec4 aTranslationScaleX;
+layout (location = 4) in vec2 aScaleYZ;
+layout (location = 5) in vec4 aRotation;
+
+uniform float pixelScale;   // viewport height / 2 * projection[1][1]
+uniform vec3 albedo;        // average of the diffuse texture
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+flat out vec3 Color;
+
+vec3 rotate(vec4 q, vec3 v){
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    vec3 center = aTranslationScaleX.xyz;
+    vec3 scale = vec3(aTranslationScaleX.w, aScaleYZ);
+    vec4 q = normalize(aRotation);
+    vec4 eye = view * vec4(center, 1.0);
+    gl_Position = projection * eye;
+
+    // same flat shading as vertex_impostor.glsl, face normals are R * axis / S
+    vec3 viewDir = normalize(viewPos - center);
+    vec3 lightDir = normalize(-directionalLight.direction);
+    float lit = 0.0, seen = 0.0, edge = 0.0;
+    for(int a = 0; a < 3; a++){
+        vec3 axis = vec3(0.0);
+        axis[a] = 1.0;
+        vec3 r = rotate(q, axis);
+        vec3 n = normalize(r / scale);
+        float facing = dot(n, viewDir);
+        lit += abs(facing) * max(dot(n * sign(facing), lightDir), 0.0);
+        seen += abs(facing);
+        edge += length(scale * r);
+    }
+    Color = albedo * (0.2 * directionalLight.ambient + directionalLight.diffuse * lit / max(seen, 1e-4));
+
+    gl_PointSize = max(1.0, 1.2 * edge / 3.0 * pixelScale / -eye.z);
+}
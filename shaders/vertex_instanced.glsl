@@ -0,0 +1,31 @@
+#version 330 core
+
+// CPU_NORMAL_MATRIX (shaderVariants.h): 1 takes the normal matrix computed on
+// the CPU, 0 inverts the model matrix here, for every vertex
+#ifndef CPU_NORMAL_MATRIX
+#define CPU_NORMAL_MATRIX 1
+#endif
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aModel; // per instance, takes locations 3-6
+layout (location = 7) in mat3 aNormalMatrix;    // per instance, 7-9, transpose(inverse(mat3(aModel)))
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+
+void main()
+{
+    gl_Position = projection * view * aModel * vec4(aPos, 1.0);
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+#if CPU_NORMAL_MATRIX
+    Normal = aNormalMatrix * aNormal;
+#else
+    Normal = mat3(transpose(inverse(aModel))) *  aNormal;
+#endif
+    TexCoords = aTexCoords;
+}
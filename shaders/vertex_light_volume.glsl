@@ -0,0 +1,17 @@
+#version 330 core
+// Deferred lighting, point lights: a box around each light's radius, one instance per light
+layout (location = 0) in vec3 aPos;     // corner of the [-1, 1] cube
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+// point lights, 4 texels each (PointLight in lightClusters.h): position and radius, ambient, diffuse, specular
+uniform samplerBuffer lightData;
+
+flat out int Light;
+
+void main()
+{
+    vec4 light = texelFetch(lightData, 4 * gl_InstanceID);
+    gl_Position = projection * view * vec4(light.xyz + aPos * light.w, 1.0);
+    Light = gl_InstanceID;
+}
@@ -6,8 +6,7 @@ layout (location = 2) in vec2 aTexCoords;
 out vec2 TexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
 
 void main()
 {
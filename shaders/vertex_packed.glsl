@@ -0,0 +1,30 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per instance, see PackedInstance: 20 bytes instead of a mat4
+layout (location = 3) in vec4 aTranslationScaleX;  // half floats
+layout (location = 4) in vec2 aScaleYZ;            // half floats
+layout (location = 5) in vec4 aRotation;           // unit quaternion, snorm16
+
+// view, projection, viewPos and directionalLight: the Frame block, frame_block.glsl
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+vec3 rotate(vec4 q, vec3 v){
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    // scale(S) * translate(spread * T) * rotate(a, axis) = S * R * x + translation
+    vec3 scale = vec3(aTranslationScaleX.w, aScaleYZ);
+    vec4 q = normalize(aRotation);
+    FragPos = scale * rotate(q, aPos) + aTranslationScaleX.xyz;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+    // the inverse transpose of S * R is R followed by 1 / S
+    Normal = rotate(q, aNormal) / scale;
+    TexCoords = aTexCoords;
+}
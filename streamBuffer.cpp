@@ -0,0 +1,96 @@
+#include "streamBuffer.h"
+#include "glExtensions.h"
+#include "glState.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+void StreamBuffer::init(GLenum t, size_t bytes_per_frame){
+    target = t;
+    persistent = glext.buffer_storage;
+    allocate(bytes_per_frame);
+}
+
+void StreamBuffer::allocate(size_t bytes){
+    destroy();
+    // keep regions a multiple of a cache line
+    region_bytes = std::max<size_t>(64, (bytes + 63) / 64 * 64);
+    region = 0;
+
+    glGenBuffers(1, &ID);
+    glstate.bind_buffer(target, ID);
+    if(persistent){
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glext.BufferStorage(target, capacity(), NULL, flags);
+        base = (char*)glMapBufferRange(target, 0, capacity(), flags);
+        if(!base){
+            std::cout << "[StreamBuffer] persistent mapping failed, falling back to per-frame mapping" << std::endl;
+            glDeleteBuffers(1, &ID);
+            ID = 0;
+            glstate.invalidate();
+            persistent = false;
+            allocate(bytes);
+        }
+    }
+    else{
+        glBufferData(target, capacity(), NULL, GL_STREAM_DRAW);
+    }
+}
+
+void StreamBuffer::destroy(){
+    for(GLsync &f : fences){
+        if(f){
+            glDeleteSync(f);
+            f = 0;
+        }
+    }
+    if(ID){
+        // deletion of a mapped buffer unmaps it, and the driver keeps the
+        // storage alive until the draws still reading it are done
+        glDeleteBuffers(1, &ID);
+        ID = 0;
+        // deleting unbinds it, and the name may come back for another buffer
+        glstate.invalidate();
+    }
+    base = nullptr;
+}
+
+void * StreamBuffer::map(size_t bytes){
+    wait_ms = 0.0;
+    if(bytes > region_bytes){
+        allocate(std::max(bytes, region_bytes + region_bytes / 2));
+    }
+
+    GLsync &f = fences[region];
+    if(f){
+        auto start = std::chrono::high_resolution_clock::now();
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while(glClientWaitSync(f, flags, 1000000) == GL_TIMEOUT_EXPIRED){
+            flags = 0;
+        }
+        glDeleteSync(f);
+        f = 0;
+        wait_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    if(persistent){
+        return base + offset();
+    }
+
+    glstate.bind_buffer(target, ID);
+    return glMapBufferRange(target, offset(), region_bytes,
+                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+void StreamBuffer::unmap(){
+    if(!persistent){
+        glstate.bind_buffer(target, ID);
+        glUnmapBuffer(target);
+    }
+}
+
+void StreamBuffer::fence(){
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % STREAM_FRAMES;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#define STREAM_FRAMES 3
+
+/**
+ * Triple-buffered streaming buffer for data rewritten every frame.
+ *
+ * The buffer is split in STREAM_FRAMES regions used round robin; a fence is
+ * placed after the draws reading a region and waited on before the CPU
+ * writes it again, so the GPU never stalls the writer unless it is a full
+ * STREAM_FRAMES frames behind.
+ *
+ * With ARB_buffer_storage the whole buffer stays persistently mapped.
+ * On plain GL 3.3 each region is mapped with GL_MAP_UNSYNCHRONIZED_BIT
+ * for the time of the write, relying on the same fences.
+ */
+class StreamBuffer {
+public:
+    unsigned int ID = 0;
+
+    void init(GLenum target, size_t bytes_per_frame);
+    void destroy();
+
+    // Waits for the next region to be free and returns a pointer to write
+    // `bytes` into it; the region grows (reallocating the buffer) if needed
+    void * map(size_t bytes);
+    // Must be called before drawing from the region
+    void unmap();
+    // Call after the last draw that reads the region, moves to the next one
+    void fence();
+
+    // Byte offset of the current region inside the buffer
+    size_t offset() const { return region * region_bytes; }
+    size_t capacity() const { return region_bytes * STREAM_FRAMES; }
+    bool is_persistent() const { return persistent; }
+
+    // Time spent waiting on fences in the last map(), in ms
+    double wait_ms = 0.0;
+
+private:
+    GLenum target = GL_ARRAY_BUFFER;
+    size_t region_bytes = 0;
+    size_t region = 0;
+    bool persistent = false;
+    char * base = nullptr;      // persistent mapping of the whole buffer
+    GLsync fences[STREAM_FRAMES] = {};
+
+    void allocate(size_t bytes);
+};
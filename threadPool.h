@@ -0,0 +1,198 @@
+#pragma once
+
+#include "alignedAllocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing pool used to spread the per-frame loops over the cube field
+ * on every core. The calling (render) thread takes part as worker 0.
+ *
+ * parallel_for cuts the range into chunks whose boundaries are multiples of
+ * `align` elements, deals them out to the per-worker deques, and every worker
+ * pops from the back of its own deque and steals from the front of the
+ * others' once it runs dry.
+ */
+class ThreadPool {
+public:
+    using Range = std::function<void(size_t begin, size_t end, unsigned worker)>;
+
+    ThreadPool(){
+
+    }
+
+    ~ThreadPool(){
+        stop();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // workers = 0 uses one worker per hardware thread
+    void start(unsigned workers = 0){
+        stop();
+        if(workers == 0){
+            workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        queues = std::vector<Queue>(workers);
+        busy = std::vector<Busy>(workers);
+        running = true;
+        for(unsigned w = 1; w < workers; w++){
+            threads.emplace_back(&ThreadPool::worker_loop, this, w);
+        }
+    }
+
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        for(auto &t : threads){
+            t.join();
+        }
+        threads.clear();
+    }
+
+    unsigned size() const { return (unsigned)queues.size(); }
+
+    void parallel_for(size_t begin, size_t end, size_t grain, size_t align, const Range &fn){
+        if(begin >= end){
+            return;
+        }
+        if(queues.size() <= 1){
+            run_timed(0, begin, end, fn);
+            return;
+        }
+
+        // ~4 chunks per worker leaves room for stealing, grain keeps them worth a task
+        size_t n = end - begin;
+        size_t chunk = std::max(grain, n / (queues.size() * 4));
+        chunk = (chunk + align - 1) / align * align;
+
+        job = &fn;
+        unsigned w = 0;
+        for(size_t b = begin; b < end; w = (w + 1) % queues.size()){
+            size_t e = std::min(end, (b / chunk + 1) * chunk);
+            pending.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(queues[w].mutex);
+                queues[w].tasks.push_back({b, e});
+            }
+            b = e;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            generation++;
+        }
+        wake.notify_all();
+
+        // the caller works too, then waits for the chunks still in flight
+        while(pending.load(std::memory_order_acquire) > 0){
+            if(!run_one(0)){
+                std::this_thread::yield();
+            }
+        }
+        job = nullptr;
+    }
+
+    // Time spent by each worker inside tasks since the last call, in ms
+    void collect_times(std::vector<double> &out){
+        out.resize(busy.size());
+        for(size_t w = 0; w < busy.size(); w++){
+            out[w] = busy[w].ms;
+            busy[w].ms = 0.0;
+        }
+    }
+
+private:
+    struct Task {
+        size_t begin, end;
+    };
+
+    struct alignas(CACHE_LINE) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // one cache line each, so timing a chunk never touches another worker's line
+    struct alignas(CACHE_LINE) Busy {
+        double ms = 0.0;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<Busy> busy;
+    std::vector<std::thread> threads;
+
+    std::atomic<const Range*> job{nullptr};
+    std::atomic<size_t> pending{0};
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    size_t generation = 0;
+    bool running = false;
+
+    void run_timed(unsigned w, size_t begin, size_t end, const Range &fn){
+        auto start = std::chrono::high_resolution_clock::now();
+        fn(begin, end, w);
+        busy[w].ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    bool pop(unsigned w, Task &t){
+        // own deque first, newest chunk
+        {
+            std::lock_guard<std::mutex> lock(queues[w].mutex);
+            if(!queues[w].tasks.empty()){
+                t = queues[w].tasks.back();
+                queues[w].tasks.pop_back();
+                return true;
+            }
+        }
+        // then steal the oldest chunk of someone else
+        for(size_t k = 1; k < queues.size(); k++){
+            Queue &q = queues[(w + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(!q.tasks.empty()){
+                t = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool run_one(unsigned w){
+        Task t;
+        if(!pop(w, t)){
+            return false;
+        }
+        run_timed(w, t.begin, t.end, *job.load(std::memory_order_acquire));
+        pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void worker_loop(unsigned w){
+        size_t seen = 0;
+        while(true){
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait(lock, [&]{ return !running || generation != seen; });
+                if(!running){
+                    return;
+                }
+                seen = generation;
+            }
+            while(run_one(w)){
+
+            }
+        }
+    }
+};